@@ -5,6 +5,218 @@
 
 using namespace Rcpp;
 
+// rcpp_dispersal_kernel
+NumericVector rcpp_dispersal_kernel(List kernel, NumericVector distance);
+RcppExport SEXP _steps_rcpp_dispersal_kernel(SEXP kernelSEXP, SEXP distanceSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type kernel(kernelSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type distance(distanceSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_dispersal_kernel(kernel, distance));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_disturbance_window
+SEXP rcpp_disturbance_window(int n_cells, int start);
+RcppExport SEXP _steps_rcpp_disturbance_window(SEXP n_cellsSEXP, SEXP startSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type n_cells(n_cellsSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_disturbance_window(n_cells, start));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_disturbance_window_span
+SEXP rcpp_disturbance_window_span(SEXP window);
+RcppExport SEXP _steps_rcpp_disturbance_window_span(SEXP windowSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type window(windowSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_disturbance_window_span(window));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_disturbance_window_push
+void rcpp_disturbance_window_push(SEXP window, NumericVector entering, SEXP leaving);
+RcppExport SEXP _steps_rcpp_disturbance_window_push(SEXP windowSEXP, SEXP enteringSEXP, SEXP leavingSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type window(windowSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type entering(enteringSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type leaving(leavingSEXP);
+    rcpp_disturbance_window_push(window, entering, leaving);
+    return R_NilValue;
+END_RCPP
+}
+// rcpp_disturbance_window_product
+NumericVector rcpp_disturbance_window_product(SEXP window);
+RcppExport SEXP _steps_rcpp_disturbance_window_product(SEXP windowSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type window(windowSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_disturbance_window_product(window));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_fft_plan
+SEXP rcpp_fft_plan(NumericMatrix kernel, int row_offset, int col_offset, int nrows, int ncols);
+RcppExport SEXP _steps_rcpp_fft_plan(SEXP kernelSEXP, SEXP row_offsetSEXP, SEXP col_offsetSEXP, SEXP nrowsSEXP, SEXP ncolsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type kernel(kernelSEXP);
+    Rcpp::traits::input_parameter< int >::type row_offset(row_offsetSEXP);
+    Rcpp::traits::input_parameter< int >::type col_offset(col_offsetSEXP);
+    Rcpp::traits::input_parameter< int >::type nrows(nrowsSEXP);
+    Rcpp::traits::input_parameter< int >::type ncols(ncolsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_fft_plan(kernel, row_offset, col_offset, nrows, ncols));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_fft_plan_valid
+bool rcpp_fft_plan_valid(SEXP plan, int nrows, int ncols);
+RcppExport SEXP _steps_rcpp_fft_plan_valid(SEXP planSEXP, SEXP nrowsSEXP, SEXP ncolsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type plan(planSEXP);
+    Rcpp::traits::input_parameter< int >::type nrows(nrowsSEXP);
+    Rcpp::traits::input_parameter< int >::type ncols(ncolsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_fft_plan_valid(plan, nrows, ncols));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_fft_convolution
+NumericMatrix rcpp_fft_convolution(SEXP plan, NumericMatrix population);
+RcppExport SEXP _steps_rcpp_fft_convolution(SEXP planSEXP, SEXP populationSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type plan(planSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type population(populationSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_fft_convolution(plan, population));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_fft_dispersal
+NumericMatrix rcpp_fft_dispersal(SEXP plan, NumericMatrix population);
+RcppExport SEXP _steps_rcpp_fft_dispersal(SEXP planSEXP, SEXP populationSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type plan(planSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type population(populationSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_fft_dispersal(plan, population));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_kernel_dispersal
+NumericMatrix rcpp_kernel_dispersal(IntegerVector offset_row, IntegerVector offset_col, NumericVector weight, int nrows, int ncols, NumericMatrix population, NumericVector arrival_probability, bool demo_stoch);
+RcppExport SEXP _steps_rcpp_kernel_dispersal(SEXP offset_rowSEXP, SEXP offset_colSEXP, SEXP weightSEXP, SEXP nrowsSEXP, SEXP ncolsSEXP, SEXP populationSEXP, SEXP arrival_probabilitySEXP, SEXP demo_stochSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< IntegerVector >::type offset_row(offset_rowSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type offset_col(offset_colSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type weight(weightSEXP);
+    Rcpp::traits::input_parameter< int >::type nrows(nrowsSEXP);
+    Rcpp::traits::input_parameter< int >::type ncols(ncolsSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type population(populationSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type arrival_probability(arrival_probabilitySEXP);
+    Rcpp::traits::input_parameter< bool >::type demo_stoch(demo_stochSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_kernel_dispersal(offset_row, offset_col, weight, nrows, ncols, population, arrival_probability, demo_stoch));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_landscape_state
+SEXP rcpp_landscape_state(IntegerVector cells, int nrows, int ncols, NumericMatrix population, bool compact);
+RcppExport SEXP _steps_rcpp_landscape_state(SEXP cellsSEXP, SEXP nrowsSEXP, SEXP ncolsSEXP, SEXP populationSEXP, SEXP compactSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< IntegerVector >::type cells(cellsSEXP);
+    Rcpp::traits::input_parameter< int >::type nrows(nrowsSEXP);
+    Rcpp::traits::input_parameter< int >::type ncols(ncolsSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type population(populationSEXP);
+    Rcpp::traits::input_parameter< bool >::type compact(compactSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_landscape_state(cells, nrows, ncols, population, compact));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_landscape_valid
+bool rcpp_landscape_valid(SEXP landscape);
+RcppExport SEXP _steps_rcpp_landscape_valid(SEXP landscapeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_landscape_valid(landscape));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_landscape_population
+NumericMatrix rcpp_landscape_population(SEXP landscape);
+RcppExport SEXP _steps_rcpp_landscape_population(SEXP landscapeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_landscape_population(landscape));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_landscape_set_population
+void rcpp_landscape_set_population(SEXP landscape, NumericMatrix population);
+RcppExport SEXP _steps_rcpp_landscape_set_population(SEXP landscapeSEXP, SEXP populationSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type population(populationSEXP);
+    rcpp_landscape_set_population(landscape, population);
+    return R_NilValue;
+END_RCPP
+}
+// rcpp_landscape_population_totals
+NumericVector rcpp_landscape_population_totals(SEXP landscape, IntegerVector stages);
+RcppExport SEXP _steps_rcpp_landscape_population_totals(SEXP landscapeSEXP, SEXP stagesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type stages(stagesSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_landscape_population_totals(landscape, stages));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_landscape_set_layer
+void rcpp_landscape_set_layer(SEXP landscape, std::string name, NumericVector values);
+RcppExport SEXP _steps_rcpp_landscape_set_layer(SEXP landscapeSEXP, SEXP nameSEXP, SEXP valuesSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    Rcpp::traits::input_parameter< std::string >::type name(nameSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type values(valuesSEXP);
+    rcpp_landscape_set_layer(landscape, name, values);
+    return R_NilValue;
+END_RCPP
+}
+// rcpp_landscape_layer
+NumericVector rcpp_landscape_layer(SEXP landscape, std::string name);
+RcppExport SEXP _steps_rcpp_landscape_layer(SEXP landscapeSEXP, SEXP nameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    Rcpp::traits::input_parameter< std::string >::type name(nameSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_landscape_layer(landscape, name));
+    return rcpp_result_gen;
+END_RCPP
+}
 // barrier_to_dispersal
 bool barrier_to_dispersal(int sink_x, int sink_y, int source_x, int source_y, NumericMatrix barriers_map, int barrier_type);
 RcppExport SEXP _steps_barrier_to_dispersal(SEXP sink_xSEXP, SEXP sink_ySEXP, SEXP source_xSEXP, SEXP source_ySEXP, SEXP barriers_mapSEXP, SEXP barrier_typeSEXP) {
@@ -22,8 +234,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // can_source_cell_disperse
-IntegerVector can_source_cell_disperse(int i, int j, NumericMatrix carrying_capacity_available, NumericMatrix tracking_population_state, NumericMatrix habitat_suitability_map, NumericMatrix barriers_map, bool use_barrier, int barrier_type, int loopID, int dispersal_distance, NumericVector dispersal_kernel);
-RcppExport SEXP _steps_can_source_cell_disperse(SEXP iSEXP, SEXP jSEXP, SEXP carrying_capacity_availableSEXP, SEXP tracking_population_stateSEXP, SEXP habitat_suitability_mapSEXP, SEXP barriers_mapSEXP, SEXP use_barrierSEXP, SEXP barrier_typeSEXP, SEXP loopIDSEXP, SEXP dispersal_distanceSEXP, SEXP dispersal_kernelSEXP) {
+IntegerVector can_source_cell_disperse(int i, int j, NumericMatrix carrying_capacity_available, NumericMatrix tracking_population_state, NumericMatrix habitat_suitability_map, NumericMatrix barriers_map, bool use_barrier, int barrier_type, int loopID, int dispersal_distance, NumericVector dispersal_kernel, bool skip_sampling);
+RcppExport SEXP _steps_can_source_cell_disperse(SEXP iSEXP, SEXP jSEXP, SEXP carrying_capacity_availableSEXP, SEXP tracking_population_stateSEXP, SEXP habitat_suitability_mapSEXP, SEXP barriers_mapSEXP, SEXP use_barrierSEXP, SEXP barrier_typeSEXP, SEXP loopIDSEXP, SEXP dispersal_distanceSEXP, SEXP dispersal_kernelSEXP, SEXP skip_samplingSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -38,7 +250,8 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< int >::type loopID(loopIDSEXP);
     Rcpp::traits::input_parameter< int >::type dispersal_distance(dispersal_distanceSEXP);
     Rcpp::traits::input_parameter< NumericVector >::type dispersal_kernel(dispersal_kernelSEXP);
-    rcpp_result_gen = Rcpp::wrap(can_source_cell_disperse(i, j, carrying_capacity_available, tracking_population_state, habitat_suitability_map, barriers_map, use_barrier, barrier_type, loopID, dispersal_distance, dispersal_kernel));
+    Rcpp::traits::input_parameter< bool >::type skip_sampling(skip_samplingSEXP);
+    rcpp_result_gen = Rcpp::wrap(can_source_cell_disperse(i, j, carrying_capacity_available, tracking_population_state, habitat_suitability_map, barriers_map, use_barrier, barrier_type, loopID, dispersal_distance, dispersal_kernel, skip_sampling));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -87,8 +300,30 @@ BEGIN_RCPP
 END_RCPP
 }
 // rcpp_dispersal
-List rcpp_dispersal(NumericMatrix starting_population_state, NumericMatrix potential_carrying_capacity, NumericMatrix habitat_suitability_map, NumericMatrix barriers_map, int barrier_type, bool use_barrier, int dispersal_steps, int dispersal_distance, NumericVector dispersal_kernel, double dispersal_proportion);
-RcppExport SEXP _steps_rcpp_dispersal(SEXP starting_population_stateSEXP, SEXP potential_carrying_capacitySEXP, SEXP habitat_suitability_mapSEXP, SEXP barriers_mapSEXP, SEXP barrier_typeSEXP, SEXP use_barrierSEXP, SEXP dispersal_stepsSEXP, SEXP dispersal_distanceSEXP, SEXP dispersal_kernelSEXP, SEXP dispersal_proportionSEXP) {
+List rcpp_dispersal(NumericMatrix starting_population_state, NumericMatrix potential_carrying_capacity, NumericMatrix habitat_suitability_map, NumericMatrix barriers_map, int barrier_type, bool use_barrier, int dispersal_steps, int dispersal_distance, NumericVector dispersal_kernel, double dispersal_proportion, bool use_frontier, bool skip_sampling);
+RcppExport SEXP _steps_rcpp_dispersal(SEXP starting_population_stateSEXP, SEXP potential_carrying_capacitySEXP, SEXP habitat_suitability_mapSEXP, SEXP barriers_mapSEXP, SEXP barrier_typeSEXP, SEXP use_barrierSEXP, SEXP dispersal_stepsSEXP, SEXP dispersal_distanceSEXP, SEXP dispersal_kernelSEXP, SEXP dispersal_proportionSEXP, SEXP use_frontierSEXP, SEXP skip_samplingSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type starting_population_state(starting_population_stateSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type potential_carrying_capacity(potential_carrying_capacitySEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type habitat_suitability_map(habitat_suitability_mapSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type barriers_map(barriers_mapSEXP);
+    Rcpp::traits::input_parameter< int >::type barrier_type(barrier_typeSEXP);
+    Rcpp::traits::input_parameter< bool >::type use_barrier(use_barrierSEXP);
+    Rcpp::traits::input_parameter< int >::type dispersal_steps(dispersal_stepsSEXP);
+    Rcpp::traits::input_parameter< int >::type dispersal_distance(dispersal_distanceSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type dispersal_kernel(dispersal_kernelSEXP);
+    Rcpp::traits::input_parameter< double >::type dispersal_proportion(dispersal_proportionSEXP);
+    Rcpp::traits::input_parameter< bool >::type use_frontier(use_frontierSEXP);
+    Rcpp::traits::input_parameter< bool >::type skip_sampling(skip_samplingSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_dispersal(starting_population_state, potential_carrying_capacity, habitat_suitability_map, barriers_map, barrier_type, use_barrier, dispersal_steps, dispersal_distance, dispersal_kernel, dispersal_proportion, use_frontier, skip_sampling));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_dispersal_tiled
+List rcpp_dispersal_tiled(NumericMatrix starting_population_state, NumericMatrix potential_carrying_capacity, NumericMatrix habitat_suitability_map, NumericMatrix barriers_map, int barrier_type, bool use_barrier, int dispersal_steps, int dispersal_distance, NumericVector dispersal_kernel, double dispersal_proportion, double seed, int n_threads, bool skip_sampling);
+RcppExport SEXP _steps_rcpp_dispersal_tiled(SEXP starting_population_stateSEXP, SEXP potential_carrying_capacitySEXP, SEXP habitat_suitability_mapSEXP, SEXP barriers_mapSEXP, SEXP barrier_typeSEXP, SEXP use_barrierSEXP, SEXP dispersal_stepsSEXP, SEXP dispersal_distanceSEXP, SEXP dispersal_kernelSEXP, SEXP dispersal_proportionSEXP, SEXP seedSEXP, SEXP n_threadsSEXP, SEXP skip_samplingSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -102,18 +337,328 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< int >::type dispersal_distance(dispersal_distanceSEXP);
     Rcpp::traits::input_parameter< NumericVector >::type dispersal_kernel(dispersal_kernelSEXP);
     Rcpp::traits::input_parameter< double >::type dispersal_proportion(dispersal_proportionSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_dispersal(starting_population_state, potential_carrying_capacity, habitat_suitability_map, barriers_map, barrier_type, use_barrier, dispersal_steps, dispersal_distance, dispersal_kernel, dispersal_proportion));
+    Rcpp::traits::input_parameter< double >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type skip_sampling(skip_samplingSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_dispersal_tiled(starting_population_state, potential_carrying_capacity, habitat_suitability_map, barriers_map, barrier_type, use_barrier, dispersal_steps, dispersal_distance, dispersal_kernel, dispersal_proportion, seed, n_threads, skip_sampling));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_dispersal_workspace
+SEXP rcpp_dispersal_workspace(SEXP workspace);
+RcppExport SEXP _steps_rcpp_dispersal_workspace(SEXP workspaceSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type workspace(workspaceSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_dispersal_workspace(workspace));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_dispersal_stages
+NumericMatrix rcpp_dispersal_stages(NumericMatrix population, NumericMatrix potential_carrying_capacity, NumericMatrix habitat_suitability_map, NumericMatrix barriers_map, int barrier_type, bool use_barrier, int dispersal_steps, IntegerVector dispersal_distance, List dispersal_kernel, NumericVector dispersal_proportion, bool use_frontier, double seed, int n_threads, SEXP workspace, bool skip_sampling);
+RcppExport SEXP _steps_rcpp_dispersal_stages(SEXP populationSEXP, SEXP potential_carrying_capacitySEXP, SEXP habitat_suitability_mapSEXP, SEXP barriers_mapSEXP, SEXP barrier_typeSEXP, SEXP use_barrierSEXP, SEXP dispersal_stepsSEXP, SEXP dispersal_distanceSEXP, SEXP dispersal_kernelSEXP, SEXP dispersal_proportionSEXP, SEXP use_frontierSEXP, SEXP seedSEXP, SEXP n_threadsSEXP, SEXP workspaceSEXP, SEXP skip_samplingSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type population(populationSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type potential_carrying_capacity(potential_carrying_capacitySEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type habitat_suitability_map(habitat_suitability_mapSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type barriers_map(barriers_mapSEXP);
+    Rcpp::traits::input_parameter< int >::type barrier_type(barrier_typeSEXP);
+    Rcpp::traits::input_parameter< bool >::type use_barrier(use_barrierSEXP);
+    Rcpp::traits::input_parameter< int >::type dispersal_steps(dispersal_stepsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type dispersal_distance(dispersal_distanceSEXP);
+    Rcpp::traits::input_parameter< List >::type dispersal_kernel(dispersal_kernelSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type dispersal_proportion(dispersal_proportionSEXP);
+    Rcpp::traits::input_parameter< bool >::type use_frontier(use_frontierSEXP);
+    Rcpp::traits::input_parameter< double >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type workspace(workspaceSEXP);
+    Rcpp::traits::input_parameter< bool >::type skip_sampling(skip_samplingSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_dispersal_stages(population, potential_carrying_capacity, habitat_suitability_map, barriers_map, barrier_type, use_barrier, dispersal_steps, dispersal_distance, dispersal_kernel, dispersal_proportion, use_frontier, seed, n_threads, workspace, skip_sampling));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_profile_counters_enabled
+bool rcpp_profile_counters_enabled();
+RcppExport SEXP _steps_rcpp_profile_counters_enabled() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(rcpp_profile_counters_enabled());
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_landscape_step
+void rcpp_landscape_step(SEXP landscape, List step, List demography);
+RcppExport SEXP _steps_rcpp_landscape_step(SEXP landscapeSEXP, SEXP stepSEXP, SEXP demographySEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    Rcpp::traits::input_parameter< List >::type step(stepSEXP);
+    Rcpp::traits::input_parameter< List >::type demography(demographySEXP);
+    rcpp_landscape_step(landscape, step, demography);
+    return R_NilValue;
+END_RCPP
+}
+// rcpp_simulate
+SEXP rcpp_simulate(List steps, IntegerVector timesteps, SEXP landscape, List demography, Function run_dynamic, Function record, bool profile);
+RcppExport SEXP _steps_rcpp_simulate(SEXP stepsSEXP, SEXP timestepsSEXP, SEXP landscapeSEXP, SEXP demographySEXP, SEXP run_dynamicSEXP, SEXP recordSEXP, SEXP profileSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type steps(stepsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type timesteps(timestepsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    Rcpp::traits::input_parameter< List >::type demography(demographySEXP);
+    Rcpp::traits::input_parameter< Function >::type run_dynamic(run_dynamicSEXP);
+    Rcpp::traits::input_parameter< Function >::type record(recordSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_simulate(steps, timesteps, landscape, demography, run_dynamic, record, profile));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_simulate_replicates
+List rcpp_simulate_replicates(List steps, int timesteps, SEXP landscape, List demography, int replicates, double seed, int n_threads, IntegerVector keep, std::string path, bool profile, std::string cache, std::string checkpoint, int checkpoint_every);
+RcppExport SEXP _steps_rcpp_simulate_replicates(SEXP stepsSEXP, SEXP timestepsSEXP, SEXP landscapeSEXP, SEXP demographySEXP, SEXP replicatesSEXP, SEXP seedSEXP, SEXP n_threadsSEXP, SEXP keepSEXP, SEXP pathSEXP, SEXP profileSEXP, SEXP cacheSEXP, SEXP checkpointSEXP, SEXP checkpoint_everySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type steps(stepsSEXP);
+    Rcpp::traits::input_parameter< int >::type timesteps(timestepsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    Rcpp::traits::input_parameter< List >::type demography(demographySEXP);
+    Rcpp::traits::input_parameter< int >::type replicates(replicatesSEXP);
+    Rcpp::traits::input_parameter< double >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type keep(keepSEXP);
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type cache(cacheSEXP);
+    Rcpp::traits::input_parameter< std::string >::type checkpoint(checkpointSEXP);
+    Rcpp::traits::input_parameter< int >::type checkpoint_every(checkpoint_everySEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_simulate_replicates(steps, timesteps, landscape, demography, replicates, seed, n_threads, keep, path, profile, cache, checkpoint, checkpoint_every));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_simulate_sweep
+List rcpp_simulate_sweep(List scenarios, int timesteps, int replicates, double seed, int n_threads, IntegerVector keep, std::string path, std::string cache, std::string checkpoint, int checkpoint_every);
+RcppExport SEXP _steps_rcpp_simulate_sweep(SEXP scenariosSEXP, SEXP timestepsSEXP, SEXP replicatesSEXP, SEXP seedSEXP, SEXP n_threadsSEXP, SEXP keepSEXP, SEXP pathSEXP, SEXP cacheSEXP, SEXP checkpointSEXP, SEXP checkpoint_everySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type scenarios(scenariosSEXP);
+    Rcpp::traits::input_parameter< int >::type timesteps(timestepsSEXP);
+    Rcpp::traits::input_parameter< int >::type replicates(replicatesSEXP);
+    Rcpp::traits::input_parameter< double >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type keep(keepSEXP);
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type cache(cacheSEXP);
+    Rcpp::traits::input_parameter< std::string >::type checkpoint(checkpointSEXP);
+    Rcpp::traits::input_parameter< int >::type checkpoint_every(checkpoint_everySEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_simulate_sweep(scenarios, timesteps, replicates, seed, n_threads, keep, path, cache, checkpoint, checkpoint_every));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_simulation_key
+std::string rcpp_simulation_key(List scenarios);
+RcppExport SEXP _steps_rcpp_simulation_key(SEXP scenariosSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type scenarios(scenariosSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_simulation_key(scenarios));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_results_file
+void rcpp_results_file(std::string path, int replicates, int timesteps, SEXP landscape);
+RcppExport SEXP _steps_rcpp_results_file(SEXP pathSEXP, SEXP replicatesSEXP, SEXP timestepsSEXP, SEXP landscapeSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< int >::type replicates(replicatesSEXP);
+    Rcpp::traits::input_parameter< int >::type timesteps(timestepsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    rcpp_results_file(path, replicates, timesteps, landscape);
+    return R_NilValue;
+END_RCPP
+}
+// rcpp_results_header
+List rcpp_results_header(std::string path);
+RcppExport SEXP _steps_rcpp_results_header(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_results_header(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_results_population
+NumericMatrix rcpp_results_population(std::string path, int replicate, int timestep);
+RcppExport SEXP _steps_rcpp_results_population(SEXP pathSEXP, SEXP replicateSEXP, SEXP timestepSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< int >::type replicate(replicateSEXP);
+    Rcpp::traits::input_parameter< int >::type timestep(timestepSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_results_population(path, replicate, timestep));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_checkpoint_file
+void rcpp_checkpoint_file(std::string path, int replicates, int timesteps, SEXP landscape, IntegerVector keep, double seed, std::string key);
+RcppExport SEXP _steps_rcpp_checkpoint_file(SEXP pathSEXP, SEXP replicatesSEXP, SEXP timestepsSEXP, SEXP landscapeSEXP, SEXP keepSEXP, SEXP seedSEXP, SEXP keySEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< int >::type replicates(replicatesSEXP);
+    Rcpp::traits::input_parameter< int >::type timesteps(timestepsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type keep(keepSEXP);
+    Rcpp::traits::input_parameter< double >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< std::string >::type key(keySEXP);
+    rcpp_checkpoint_file(path, replicates, timesteps, landscape, keep, seed, key);
+    return R_NilValue;
+END_RCPP
+}
+// rcpp_checkpoint_header
+List rcpp_checkpoint_header(std::string path);
+RcppExport SEXP _steps_rcpp_checkpoint_header(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_checkpoint_header(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_checkpoint_discard
+void rcpp_checkpoint_discard(std::string path, int replicate);
+RcppExport SEXP _steps_rcpp_checkpoint_discard(SEXP pathSEXP, SEXP replicateSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< int >::type replicate(replicateSEXP);
+    rcpp_checkpoint_discard(path, replicate);
+    return R_NilValue;
+END_RCPP
+}
+// rcpp_population_summary
+SEXP rcpp_population_summary(SEXP landscape, int timesteps, std::string path, int replicate);
+RcppExport SEXP _steps_rcpp_population_summary(SEXP landscapeSEXP, SEXP timestepsSEXP, SEXP pathSEXP, SEXP replicateSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    Rcpp::traits::input_parameter< int >::type timesteps(timestepsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< int >::type replicate(replicateSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_population_summary(landscape, timesteps, path, replicate));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_summary_record
+void rcpp_summary_record(SEXP summary, SEXP landscape, int timestep);
+RcppExport SEXP _steps_rcpp_summary_record(SEXP summarySEXP, SEXP landscapeSEXP, SEXP timestepSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type summary(summarySEXP);
+    Rcpp::traits::input_parameter< SEXP >::type landscape(landscapeSEXP);
+    Rcpp::traits::input_parameter< int >::type timestep(timestepSEXP);
+    rcpp_summary_record(summary, landscape, timestep);
+    return R_NilValue;
+END_RCPP
+}
+// rcpp_summary_results
+List rcpp_summary_results(SEXP summary);
+RcppExport SEXP _steps_rcpp_summary_results(SEXP summarySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type summary(summarySEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_summary_results(summary));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_stage_projection
+NumericMatrix rcpp_stage_projection(NumericMatrix population, NumericVector transition, IntegerVector matrix_index, bool demo_stoch);
+RcppExport SEXP _steps_rcpp_stage_projection(SEXP populationSEXP, SEXP transitionSEXP, SEXP matrix_indexSEXP, SEXP demo_stochSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type population(populationSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type transition(transitionSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type matrix_index(matrix_indexSEXP);
+    Rcpp::traits::input_parameter< bool >::type demo_stoch(demo_stochSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_stage_projection(population, transition, matrix_index, demo_stoch));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_truncated_normal
+NumericMatrix rcpp_truncated_normal(int n, NumericVector mean, NumericVector sd, NumericVector lower, NumericVector upper);
+RcppExport SEXP _steps_rcpp_truncated_normal(SEXP nSEXP, SEXP meanSEXP, SEXP sdSEXP, SEXP lowerSEXP, SEXP upperSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type n(nSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type mean(meanSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type sd(sdSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type lower(lowerSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type upper(upperSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_truncated_normal(n, mean, sd, lower, upper));
     return rcpp_result_gen;
 END_RCPP
 }
 
 static const R_CallMethodDef CallEntries[] = {
+    {"_steps_rcpp_dispersal_kernel", (DL_FUNC) &_steps_rcpp_dispersal_kernel, 2},
+    {"_steps_rcpp_disturbance_window", (DL_FUNC) &_steps_rcpp_disturbance_window, 2},
+    {"_steps_rcpp_disturbance_window_span", (DL_FUNC) &_steps_rcpp_disturbance_window_span, 1},
+    {"_steps_rcpp_disturbance_window_push", (DL_FUNC) &_steps_rcpp_disturbance_window_push, 3},
+    {"_steps_rcpp_disturbance_window_product", (DL_FUNC) &_steps_rcpp_disturbance_window_product, 1},
+    {"_steps_rcpp_fft_plan", (DL_FUNC) &_steps_rcpp_fft_plan, 5},
+    {"_steps_rcpp_fft_plan_valid", (DL_FUNC) &_steps_rcpp_fft_plan_valid, 3},
+    {"_steps_rcpp_fft_convolution", (DL_FUNC) &_steps_rcpp_fft_convolution, 2},
+    {"_steps_rcpp_fft_dispersal", (DL_FUNC) &_steps_rcpp_fft_dispersal, 2},
+    {"_steps_rcpp_kernel_dispersal", (DL_FUNC) &_steps_rcpp_kernel_dispersal, 8},
+    {"_steps_rcpp_landscape_state", (DL_FUNC) &_steps_rcpp_landscape_state, 5},
+    {"_steps_rcpp_landscape_valid", (DL_FUNC) &_steps_rcpp_landscape_valid, 1},
+    {"_steps_rcpp_landscape_population", (DL_FUNC) &_steps_rcpp_landscape_population, 1},
+    {"_steps_rcpp_landscape_set_population", (DL_FUNC) &_steps_rcpp_landscape_set_population, 2},
+    {"_steps_rcpp_landscape_population_totals", (DL_FUNC) &_steps_rcpp_landscape_population_totals, 2},
+    {"_steps_rcpp_landscape_set_layer", (DL_FUNC) &_steps_rcpp_landscape_set_layer, 3},
+    {"_steps_rcpp_landscape_layer", (DL_FUNC) &_steps_rcpp_landscape_layer, 2},
     {"_steps_barrier_to_dispersal", (DL_FUNC) &_steps_barrier_to_dispersal, 6},
-    {"_steps_can_source_cell_disperse", (DL_FUNC) &_steps_can_source_cell_disperse, 11},
+    {"_steps_can_source_cell_disperse", (DL_FUNC) &_steps_can_source_cell_disperse, 12},
     {"_steps_clean_matrix", (DL_FUNC) &_steps_clean_matrix, 5},
     {"_steps_proportion_of_population_to_disperse", (DL_FUNC) &_steps_proportion_of_population_to_disperse, 7},
     {"_steps_na_matrix", (DL_FUNC) &_steps_na_matrix, 2},
-    {"_steps_rcpp_dispersal", (DL_FUNC) &_steps_rcpp_dispersal, 10},
+    {"_steps_rcpp_dispersal", (DL_FUNC) &_steps_rcpp_dispersal, 12},
+    {"_steps_rcpp_dispersal_tiled", (DL_FUNC) &_steps_rcpp_dispersal_tiled, 13},
+    {"_steps_rcpp_dispersal_workspace", (DL_FUNC) &_steps_rcpp_dispersal_workspace, 1},
+    {"_steps_rcpp_dispersal_stages", (DL_FUNC) &_steps_rcpp_dispersal_stages, 15},
+    {"_steps_rcpp_profile_counters_enabled", (DL_FUNC) &_steps_rcpp_profile_counters_enabled, 0},
+    {"_steps_rcpp_landscape_step", (DL_FUNC) &_steps_rcpp_landscape_step, 3},
+    {"_steps_rcpp_simulate", (DL_FUNC) &_steps_rcpp_simulate, 7},
+    {"_steps_rcpp_simulate_replicates", (DL_FUNC) &_steps_rcpp_simulate_replicates, 13},
+    {"_steps_rcpp_simulate_sweep", (DL_FUNC) &_steps_rcpp_simulate_sweep, 10},
+    {"_steps_rcpp_simulation_key", (DL_FUNC) &_steps_rcpp_simulation_key, 1},
+    {"_steps_rcpp_results_file", (DL_FUNC) &_steps_rcpp_results_file, 4},
+    {"_steps_rcpp_results_header", (DL_FUNC) &_steps_rcpp_results_header, 1},
+    {"_steps_rcpp_results_population", (DL_FUNC) &_steps_rcpp_results_population, 3},
+    {"_steps_rcpp_checkpoint_file", (DL_FUNC) &_steps_rcpp_checkpoint_file, 7},
+    {"_steps_rcpp_checkpoint_header", (DL_FUNC) &_steps_rcpp_checkpoint_header, 1},
+    {"_steps_rcpp_checkpoint_discard", (DL_FUNC) &_steps_rcpp_checkpoint_discard, 2},
+    {"_steps_rcpp_population_summary", (DL_FUNC) &_steps_rcpp_population_summary, 4},
+    {"_steps_rcpp_summary_record", (DL_FUNC) &_steps_rcpp_summary_record, 3},
+    {"_steps_rcpp_summary_results", (DL_FUNC) &_steps_rcpp_summary_results, 1},
+    {"_steps_rcpp_stage_projection", (DL_FUNC) &_steps_rcpp_stage_projection, 4},
+    {"_steps_rcpp_truncated_normal", (DL_FUNC) &_steps_rcpp_truncated_normal, 5},
     {NULL, NULL, 0}
 };
 
@@ -0,0 +1,442 @@
+#ifndef STEPS_BARRIER_PATHS_H
+#define STEPS_BARRIER_PATHS_H
+
+#include <Rcpp.h>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <sstream>
+#include <chrono>
+#include <cstdio>
+#include <stdint.h>
+#include "dispersal_stencil.h"
+#include "random_streams.h"
+#include "profile_counters.h"
+
+/*
+** Barriers to dispersal are checked along five straight paths between a sink
+** and a source pixel: the middle path and paths offset by 0.49 pixels towards
+** each corner (top-left, top-right, down-left, down-right). Each path visits
+** max(|dx|, |dy|) pixels, from the pixel next to the sink up to the source.
+**
+** With weak barriers (barrier_type = 0) dispersal is blocked only if all five
+** paths cross a barrier; with strong barriers (barrier_type = 1) it is blocked
+** if more than one path does. A barrier pixel with value p blocks a path with
+** probability p.
+**
+** Cost-distance barriers (barrier_type = 2) are not sampled along paths.
+** Instead, the cheapest path from the sink to each source is found over the
+** 8-connected pixel grid, where a step costs its length (1, or sqrt(2) on the
+** diagonal) times the resistance of the pixel it enters: 1 / (1 - p) for a
+** barrier value p < 1 (so open ground, 0 or NA, costs 1), while pixels with
+** p >= 1 can't be entered, nor cut across diagonally. The detour (and extra
+** resistance) on that path, over the cost of the same offset on open ground,
+** is added to the straight-line distance, and the source disperses with the
+** kernel value at that effective distance - or not at all, if it is beyond
+** the dispersal distance. Barriers can then only lengthen dispersal, and a
+** curved barrier, such as a river, is followed rather than crossed.
+*/
+
+/* floor(a / b) for b > 0 */
+inline int floor_div(long a, long b){
+  long q = a / b;
+  if ((a % b != 0) && (a < 0)) q--;
+  return (int) q;
+}
+
+/*
+** Append the linear offsets (relative to the sink) of the pixels on the five
+** paths to a source at (dx, dy), path by path. Pixel positions are rounded
+** with exact integer arithmetic (halves are rounded up) so that a path only
+** depends on the offset, not on where the sink is.
+*/
+inline void barrier_path_pixels(int dx, int dy, int barrier_type, int nrows, std::vector<int>& pixels){
+  int distance_max = std::max(std::abs(dx), std::abs(dy));
+  long dm = distance_max;
+  /* corner offsets, in the order the paths are checked: middle, top-left, top-right, down-left, down-right */
+  static const int corner_x[5] = {0, -1, 1, -1, 1};
+  static const int corner_y[5] = {0, -1, -1, 1, 1};
+  int path, i, x, y;
+
+  for (path = 0; path < 5; path++){
+    for (i = 1; i <= distance_max; i++){
+      if (path == 0){
+        /* round(i / distance_max * dist) */
+        x = floor_div(dm + 2L * i * dx, 2L * dm);
+        y = floor_div(dm + 2L * i * dy, 2L * dm);
+      } else if (barrier_type == 0){
+        /* round(+-0.49 + i / distance_max * dist) */
+        x = floor_div((corner_x[path] < 0 ? 1L : 99L) * dm + 100L * i * dx, 100L * dm);
+        y = floor_div((corner_y[path] < 0 ? 1L : 99L) * dm + 100L * i * dy, 100L * dm);
+      } else {
+        /* strong barriers test the middle of each step: round(+-0.49 + (i - 0.5) / distance_max * dist) */
+        x = floor_div((corner_x[path] < 0 ? 2L : 198L) * dm + 100L * (2L * i - 1) * dx, 200L * dm);
+        y = floor_div((corner_y[path] < 0 ? 2L : 198L) * dm + 100L * (2L * i - 1) * dy, 200L * dm);
+      }
+      pixels.push_back(x + y * nrows);
+    }
+  }
+}
+
+/* the cost of entering a pixel with a barrier value, relative to open ground (infinite if it can't be entered) */
+inline double barrier_resistance(double value){
+  if (R_IsNA(value) || R_IsNaN(value) || value <= 0) return 1.0;
+  if (value >= 1) return R_PosInf;
+  return 1.0 / (1.0 - value);
+}
+
+template <class RNG>
+inline bool path_blocked(RNG& rng, const double* barriers, int sink, const int* pixels, int length){
+  STEPS_COUNT(barrier_rays, 1);
+  for (int i = 0; i < length; i++){
+    STEPS_COUNT(random_draws, barriers[sink + pixels[i]] > 0 && barriers[sink + pixels[i]] < 1);
+    if (rng_bernoulli(rng, barriers[sink + pixels[i]]) == 1) return true;
+  }
+  return false;
+}
+
+/* Is dispersal from the source to the sink blocked? pixels holds the five paths of length pixels each. */
+template <class RNG>
+inline bool paths_blocked(RNG& rng, const double* barriers, int sink, const int* pixels, int length, int barrier_type){
+  int path, barrier_counter = 0;
+  if (barrier_type == 0){
+    /* Weak barrier: If there is at least one free path we're good. */
+    for (path = 0; path < 5; path++){
+      if (!path_blocked(rng, barriers, sink, pixels + path * length, length)) return false;
+    }
+    return true;
+  } else if (barrier_type == 1){
+    /* Strong barrier: If more than one way is blocked by a barrier then colonization fails. */
+    for (path = 0; path < 5; path++){
+      if (path_blocked(rng, barriers, sink, pixels + path * length, length)) barrier_counter++;
+      if (barrier_counter > 1) return true;
+    }
+  }
+  return false;
+}
+
+/*
+** barrier_paths: barrier checks for every offset of a dispersal stencil over
+**            one barrier layer.
+**
+** The path pixels of each stencil offset are computed once. Sinks with no
+** barrier pixel within the dispersal distance are never blocked and are
+** skipped without any work. If the layer only contains 0, 1 and NA (no
+** random draws are needed), whether each (sink, offset) path is open is
+** cached the first time it is checked, and reused for later steps (and for
+** later calls when kept in a workspace). Cache entries are updated
+** atomically, so sinks (or replicates) can be checked from different threads.
+**
+** With cost-distance barriers, the effective distances (as rounded rings) of
+** the stencil offsets around a sink are found with a Dijkstra search bounded
+** by the cost at which any source would be beyond the dispersal distance.
+** They are found the first time the sink is dispersed to and kept (within
+** the same 256MB limit) until the barrier layer changes; a thread finding a
+** sink another thread is still searching from makes its own search.
+*/
+class barrier_paths {
+public:
+  barrier_paths(const dispersal_stencil& stencil, const Rcpp::NumericMatrix& barriers_map, int barrier_type) :
+    barrier_type(barrier_type), distance(stencil.distance), nrows(barriers_map.nrow()),
+    ncols(barriers_map.ncol()), n_offsets(stencil.size()), reach(stencil.distance),
+    values(barriers_map.begin(), barriers_map.end()), limit(0) {
+
+    int n, i, j;
+
+    if (barrier_type < 0 || barrier_type > 2) Rcpp::stop("barrier_type must be 0, 1 or 2");
+
+    if (barrier_type == 2){
+      /* each stencil offset, and how far the search must go: a source is only
+      ** within the dispersal distance if its cost is below
+      ** distance + 0.5 - (straight-line distance - open ground cost) */
+      for (n = 0; n < n_offsets; n++){
+        int dx = std::abs(stencil.dx[n]), dy = std::abs(stencil.dy[n]);
+        double open = std::max(dx, dy) + (std::sqrt(2.0) - 1) * std::min(dx, dy);
+        excess.push_back(std::sqrt((double) (dx * dx + dy * dy)) - open);
+        limit = std::max(limit, distance + 0.5 - excess.back());
+      }
+      /* every step costs at least 1, so the search stays within this many pixels of the sink */
+      reach = (int) std::ceil(limit);
+      resistance.resize(values.size());
+      for (size_t cell = 0; cell < values.size(); cell++) resistance[cell] = barrier_resistance(values[cell]);
+    } else {
+      /* path pixels for each stencil offset */
+      for (n = 0; n < n_offsets; n++){
+        start.push_back(pixels.size());
+        length.push_back(std::max(std::abs(stencil.dx[n]), std::abs(stencil.dy[n])));
+        barrier_path_pixels(stencil.dx[n], stencil.dy[n], barrier_type, nrows, pixels);
+      }
+    }
+    dx.assign(stencil.dx.begin(), stencil.dx.end());
+    dy.assign(stencil.dy.begin(), stencil.dy.end());
+
+    /* sinks with a barrier pixel (a non-zero, non-NA value) within reach */
+    deterministic = true;
+    std::vector<int> counts((nrows + 1) * (ncols + 1), 0);
+    for (j = 0; j < ncols; j++){
+      for (i = 0; i < nrows; i++){
+        double value = values[i + j * nrows];
+        if (!(value == 0 || value == 1 || R_IsNA(value) || R_IsNaN(value))) deterministic = false;
+        counts[(i + 1) + (j + 1) * (nrows + 1)] = (value > 0) +
+          counts[i + (j + 1) * (nrows + 1)] + counts[(i + 1) + j * (nrows + 1)] - counts[i + j * (nrows + 1)];
+      }
+    }
+    int n_near = 0;
+    near.assign(nrows * ncols, -1);
+    for (j = 0; j < ncols; j++){
+      for (i = 0; i < nrows; i++){
+        int row_min = std::max(i - reach, 0), row_max = std::min(i + reach, nrows - 1);
+        int col_min = std::max(j - reach, 0), col_max = std::min(j + reach, ncols - 1);
+        int count = counts[(row_max + 1) + (col_max + 1) * (nrows + 1)] - counts[row_min + (col_max + 1) * (nrows + 1)] -
+          counts[(row_max + 1) + col_min * (nrows + 1)] + counts[row_min + col_min * (nrows + 1)];
+        if (count > 0) near[i + j * nrows] = n_near++;
+      }
+    }
+
+    /* two bits per (sink, offset): 0 = not checked yet, 1 = open, 2 = blocked. Only cache
+    ** if it is reasonably small (at most 2^25 words, or 256MB). */
+    words_per_sink = (n_offsets + 31) / 32;
+    if (barrier_type != 2 && deterministic && (double) n_near * words_per_sink <= 33554432.0){
+      status.assign((size_t) n_near * words_per_sink, 0);
+    }
+
+    /* the effective rings of each sink within reach of a barrier, if there
+    ** are at most 2^27 of them (256MB) */
+    if (barrier_type == 2 && (double) n_near * n_offsets <= 134217728.0){
+      rings.assign((size_t) n_near * n_offsets, 0);
+      found.assign(n_near, 0);
+    }
+  }
+
+  /* Are the barriers cost-distance barriers (see effective_rings), rather than blocking paths? */
+  bool cost_distance() const { return barrier_type == 2; }
+
+  /* Is dispersal to sink (a linear index) from the source at stencil offset n blocked? */
+  template <class RNG>
+  bool blocked(RNG& rng, int sink, int n){
+    if (barrier_type == 2) return false;
+    int row = near[sink];
+    if (row < 0) return false;
+    if (status.empty()){
+      return paths_blocked(rng, &values[0], sink, &pixels[start[n]], length[n], barrier_type);
+    }
+    uint64_t* word = &status[(size_t) row * words_per_sink + n / 32];
+    int shift = 2 * (n % 32);
+    int cached = (__atomic_load_n(word, __ATOMIC_RELAXED) >> shift) & 3;
+    if (cached == 0){
+      cached = paths_blocked(rng, &values[0], sink, &pixels[start[n]], length[n], barrier_type) ? 2 : 1;
+      /* replicates on other threads may be checking the same sink */
+      __atomic_fetch_or(word, (uint64_t) cached << shift, __ATOMIC_RELAXED);
+    }
+    return cached == 2;
+  }
+
+  /*
+  ** The effective distances (rounded, or 0 if beyond the dispersal distance)
+  ** of the sources at each stencil offset around sink, or NULL if there is no
+  ** barrier within reach, so that the stencil's own rings apply. Only valid
+  ** until the next call on the same thread.
+  */
+  const uint16_t* effective_rings(int sink){
+    int row = near[sink];
+    if (row < 0) return NULL;
+    if (!found.empty()){
+      uint16_t* kept = &rings[(size_t) row * n_offsets];
+      int* state = &found[row];
+      /* 0 = not searched, 1 = being searched, 2 = kept */
+      int expected = __atomic_load_n(state, __ATOMIC_ACQUIRE);
+      if (expected == 2) return kept;
+      if (expected == 0 && __atomic_compare_exchange_n(state, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+        search(sink, kept);
+        __atomic_store_n(state, 2, __ATOMIC_RELEASE);
+        return kept;
+      }
+    }
+    static thread_local std::vector<uint16_t> scratch;
+    scratch.resize(n_offsets);
+    search(sink, &scratch[0]);
+    return &scratch[0];
+  }
+
+  /*
+  ** What the paths have found (the status of the paths checked, or the rings
+  ** of the sinks searched from) can be saved to a cache file and merged into
+  ** paths built for the same stencil distance and barrier layer by a later
+  ** simulation, in any process (see dispersal_artifacts). The file is
+  **
+  **   char[8]  "STEPSBAR"
+  **   int32    version (1), barrier type, distance, nrows, ncols, stencil
+  **            offsets, sinks within reach of a barrier
+  **   uint64   the key of the paths (see key()), and the numbers of status
+  **            words and rings
+  **   uint64   the status words
+  **   int32    whether each sink's rings were found (2) or not (0)
+  **   uint16   the rings
+  **
+  ** in native byte order, so it can be read (or memory-mapped) as is.
+  */
+  bool cacheable() const { return !status.empty() || !rings.empty(); }
+
+  /* a hash of the barrier type, stencil distance and barrier layer */
+  uint64_t key() const {
+    uint64_t hash = mix_seed(mix_seed(mix_seed(barrier_type, distance), nrows), ncols);
+    for (size_t cell = 0; cell < values.size(); cell++){
+      uint64_t bits;
+      std::memcpy(&bits, &values[cell], sizeof(bits));
+      hash = mix_seed(hash, bits);
+    }
+    return hash;
+  }
+
+  /* merge in what was saved to the cache file at path; false if it has nothing for these paths */
+  bool load(const std::string& path, uint64_t paths_key){
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == NULL) return false;
+    char magic[8];
+    int32_t header[7];
+    uint64_t saved[3];
+    std::vector<int32_t> header_expected = cache_header();
+    bool valid = std::fread(magic, 1, 8, file) == 8 && std::memcmp(magic, "STEPSBAR", 8) == 0 &&
+      std::fread(header, sizeof(int32_t), 7, file) == 7 && std::equal(header, header + 7, header_expected.begin()) &&
+      std::fread(saved, sizeof(uint64_t), 3, file) == 3 && saved[0] == paths_key &&
+      saved[1] == status.size() && saved[2] == rings.size();
+    std::vector<uint64_t> saved_status(valid ? status.size() : 0);
+    std::vector<int32_t> saved_found(valid ? found.size() : 0);
+    std::vector<uint16_t> saved_rings(valid ? rings.size() : 0);
+    valid = valid && std::fread(saved_status.data(), sizeof(uint64_t), saved_status.size(), file) == saved_status.size() &&
+      std::fread(saved_found.data(), sizeof(int32_t), saved_found.size(), file) == saved_found.size() &&
+      std::fread(saved_rings.data(), sizeof(uint16_t), saved_rings.size(), file) == saved_rings.size();
+    std::fclose(file);
+    if (!valid) return false;
+
+    for (size_t word = 0; word < status.size(); word++) status[word] |= saved_status[word];
+    for (size_t row = 0; row < found.size(); row++){
+      if (saved_found[row] != 2 || found[row] == 2) continue;
+      std::copy(saved_rings.begin() + row * n_offsets, saved_rings.begin() + (row + 1) * n_offsets,
+                rings.begin() + row * n_offsets);
+      found[row] = 2;
+    }
+    return true;
+  }
+
+  /* save what has been found to the cache file at path (which is replaced whole); false if it can't be */
+  bool save(const std::string& path, uint64_t paths_key) const {
+    std::ostringstream part;
+    part << path << "." << (uintptr_t) this << "." << std::chrono::steady_clock::now().time_since_epoch().count();
+    FILE* file = std::fopen(part.str().c_str(), "wb");
+    if (file == NULL) return false;
+    std::vector<int32_t> header = cache_header();
+    uint64_t saved[3] = {paths_key, status.size(), rings.size()};
+    /* sinks still being searched (there are none once dispersal has finished) weren't found */
+    std::vector<int32_t> saved_found(found.size());
+    for (size_t row = 0; row < found.size(); row++) saved_found[row] = found[row] == 2 ? 2 : 0;
+    bool written = std::fwrite("STEPSBAR", 1, 8, file) == 8 &&
+      std::fwrite(header.data(), sizeof(int32_t), 7, file) == 7 &&
+      std::fwrite(saved, sizeof(uint64_t), 3, file) == 3 &&
+      std::fwrite(status.data(), sizeof(uint64_t), status.size(), file) == status.size() &&
+      std::fwrite(saved_found.data(), sizeof(int32_t), saved_found.size(), file) == saved_found.size() &&
+      std::fwrite(rings.data(), sizeof(uint16_t), rings.size(), file) == rings.size();
+    written = std::fclose(file) == 0 && written;
+    /* renamed into place, so that other processes never read it half written */
+    if (written && std::rename(part.str().c_str(), path.c_str()) != 0){
+      std::remove(path.c_str());
+      written = std::rename(part.str().c_str(), path.c_str()) == 0;
+    }
+    if (!written) std::remove(part.str().c_str());
+    return written;
+  }
+
+  /* Were these paths built for this stencil, barrier type and barrier layer? */
+  bool built_for(const dispersal_stencil& stencil, const Rcpp::NumericMatrix& barriers_map, int type) const {
+    return (type == barrier_type) && (stencil.distance == distance) && (stencil.nrows == nrows) &&
+      (barriers_map.size() == (int) values.size()) &&
+      (std::memcmp(&values[0], barriers_map.begin(), values.size() * sizeof(double)) == 0);
+  }
+
+private:
+  std::vector<int32_t> cache_header() const {
+    int32_t header[7] = {1, barrier_type, distance, nrows, ncols, n_offsets, (int32_t) (near.empty() ? 0 :
+                         1 + *std::max_element(near.begin(), near.end()))};
+    return std::vector<int32_t>(header, header + 7);
+  }
+
+  /* the bounded cost-distance search from sink, writing the effective ring of each stencil offset */
+  void search(int sink, uint16_t* found_rings) const {
+    typedef std::pair<double, int> entry;
+    static const int step_x[8] = {-1, 1, 0, 0, -1, -1, 1, 1};
+    static const int step_y[8] = {0, 0, -1, 1, -1, 1, -1, 1};
+    static thread_local std::vector<double> cost;
+    static thread_local std::vector<entry> queue;
+    int side = 2 * reach + 1;
+    int sink_x = sink % nrows, sink_y = sink / nrows;
+    int s, n;
+
+    cost.assign((size_t) side * side, R_PosInf);
+    queue.clear();
+    cost[reach + reach * side] = 0;
+    queue.push_back(entry(0.0, reach + reach * side));
+
+    while (!queue.empty()){
+      std::pop_heap(queue.begin(), queue.end(), std::greater<entry>());
+      entry next = queue.back();
+      queue.pop_back();
+      if (next.first > cost[next.second]) continue;
+      int a = next.second % side, b = next.second / side;
+      for (s = 0; s < 8; s++){
+        int a2 = a + step_x[s], b2 = b + step_y[s];
+        if (a2 < 0 || a2 >= side || b2 < 0 || b2 >= side) continue;
+        double entering = pixel_resistance(sink_x - reach + a2, sink_y - reach + b2);
+        if (entering == R_PosInf) continue;
+        /* no cutting diagonally between two pixels that can't be entered */
+        if (s >= 4 && pixel_resistance(sink_x - reach + a2, sink_y - reach + b) == R_PosInf &&
+            pixel_resistance(sink_x - reach + a, sink_y - reach + b2) == R_PosInf) continue;
+        double reached = next.first + (s >= 4 ? std::sqrt(2.0) : 1.0) * entering;
+        int w = a2 + b2 * side;
+        if (reached < limit && reached < cost[w]){
+          cost[w] = reached;
+          queue.push_back(entry(reached, w));
+          std::push_heap(queue.begin(), queue.end(), std::greater<entry>());
+        }
+      }
+    }
+
+    for (n = 0; n < n_offsets; n++){
+      double c = cost[(reach + dx[n]) + (reach + dy[n]) * side];
+      int ring = (c == R_PosInf) ? 0 : (int) std::floor(c + excess[n] + 0.5);
+      found_rings[n] = (ring <= distance) ? ring : 0;
+    }
+  }
+
+  /* the resistance of the pixel at row i, column j (pixels off the landscape can't be entered) */
+  double pixel_resistance(int i, int j) const {
+    if (i < 0 || i >= nrows || j < 0 || j >= ncols) return R_PosInf;
+    return resistance[i + j * nrows];
+  }
+
+  int barrier_type;
+  int distance;
+  int nrows;
+  int ncols;
+  int n_offsets;
+  int reach;                     // how far from a sink barriers are looked for.
+  std::vector<double> values;    // the barrier layer.
+  std::vector<int> dx;           // stencil offsets.
+  std::vector<int> dy;
+  std::vector<int> start;        // first path pixel of each stencil offset.
+  std::vector<int> length;       // pixels per path for each stencil offset.
+  std::vector<int> pixels;       // path pixels, as linear offsets relative to the sink.
+  std::vector<int> near;         // cache row of each sink with a barrier within reach, or -1.
+  bool deterministic;            // barrier values are all 0, 1 or NA.
+  int words_per_sink;
+  std::vector<uint64_t> status;  // cached path status, empty if not cached.
+  double limit;                  // cost-distance searches stop at this cost.
+  std::vector<double> excess;    // straight-line distance less open ground cost, per stencil offset.
+  std::vector<double> resistance;  // barrier_resistance of each pixel.
+  std::vector<uint16_t> rings;   // effective rings of the sinks within reach of a barrier, if kept.
+  std::vector<int> found;        // whether each sink's rings have been found (see effective_rings).
+};
+
+#endif
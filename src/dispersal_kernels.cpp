@@ -0,0 +1,128 @@
+#include <Rcpp.h>
+#include <cmath>
+#include <string>
+#include <algorithm>
+using namespace Rcpp;
+
+/*
+** Dispersal kernels as functions of distance, evaluated natively from the
+** descriptors kept by dispersal_function objects (see
+** native_dispersal_kernel in R/dispersal_function-class.R):
+**
+**   exponential    exp(-r / decay), normalised by 1 / (2 pi decay^2)
+**   gaussian       exp(-r^2 / (2 sigma^2)), normalised by 1 / (2 pi sigma^2)
+**   student_t      the 2Dt kernel (1 + r^2 / scale)^-(shape + 1), normalised
+**                  by shape / (pi scale)
+**   inverse_power  (1 + r / scale)^-exponent, normalised by
+**                  (exponent - 1) (exponent - 2) / (2 pi scale^2)
+**   tabulated      linear interpolation between values at increasing
+**                  distances, the first value below the first distance and 0
+**                  beyond the last
+**
+** Each family is a small functor, and the loop over distances is instantiated
+** for each one, so evaluating a kernel costs no more than the arithmetic.
+*/
+
+struct exponential_kernel {
+  double decay, scale;
+  double operator()(double r) const { return scale * std::exp(-r / decay); }
+};
+
+struct gaussian_kernel {
+  double two_variance, scale;
+  double operator()(double r) const { return scale * std::exp(-r * r / two_variance); }
+};
+
+struct student_t_kernel {
+  double spread, power, scale;
+  double operator()(double r) const { return scale * std::pow(1 + r * r / spread, -power); }
+};
+
+struct inverse_power_kernel {
+  double distance_scale, exponent, scale;
+  double operator()(double r) const { return scale * std::pow(1 + r / distance_scale, -exponent); }
+};
+
+struct tabulated_kernel {
+  const double* distance;
+  const double* value;
+  int n;
+  double operator()(double r) const {
+    if (r <= distance[0]) return value[0];
+    if (r > distance[n - 1]) return 0.0;
+    /* the first tabulated distance at or beyond r */
+    int upper = std::lower_bound(distance, distance + n, r) - distance;
+    int lower = upper - 1;
+    double w = (r - distance[lower]) / (distance[upper] - distance[lower]);
+    return value[lower] + w * (value[upper] - value[lower]);
+  }
+};
+
+template <class Kernel>
+static void evaluate_kernel(const Kernel& kernel, const double* distance, double* value, R_xlen_t n){
+  for (R_xlen_t i = 0; i < n; i++){
+    value[i] = (R_IsNA(distance[i]) || R_IsNaN(distance[i])) ? NA_REAL : kernel(distance[i]);
+  }
+}
+
+static double kernel_parameter(const NumericVector& parameters, const char* name){
+  if (!parameters.containsElementNamed(name)) stop("the kernel has no '%s' parameter", name);
+  return parameters[name];
+}
+
+// //' evaluate a dispersal kernel descriptor (a list of family, parameters, normalize and, for tabulated kernels, distances and values) at some distances
+// //' @param kernel the descriptor, as kept by native_dispersal_kernel.
+// //' @param distance distances at which to evaluate it (an empty vector just checks the descriptor).
+// [[Rcpp::export]]
+NumericVector rcpp_dispersal_kernel(List kernel, NumericVector distance){
+  std::string family = as<std::string>(kernel["family"]);
+  NumericVector parameters = kernel["parameters"];
+  bool normalize = as<bool>(kernel["normalize"]);
+  NumericVector value(distance.size());
+  const double* r = distance.begin();
+  double* out = value.begin();
+  R_xlen_t n = distance.size();
+
+  if (family == "exponential"){
+    double decay = kernel_parameter(parameters, "distance_decay");
+    if (!(decay > 0)) stop("distance_decay must be positive");
+    exponential_kernel k = {decay, normalize ? 1 / (2 * M_PI * decay * decay) : 1.0};
+    evaluate_kernel(k, r, out, n);
+
+  } else if (family == "gaussian"){
+    double sigma = kernel_parameter(parameters, "sigma");
+    if (!(sigma > 0)) stop("sigma must be positive");
+    gaussian_kernel k = {2 * sigma * sigma, normalize ? 1 / (2 * M_PI * sigma * sigma) : 1.0};
+    evaluate_kernel(k, r, out, n);
+
+  } else if (family == "student_t"){
+    double spread = kernel_parameter(parameters, "scale"), shape = kernel_parameter(parameters, "shape");
+    if (!(spread > 0) || !(shape > 0)) stop("scale and shape must be positive");
+    student_t_kernel k = {spread, shape + 1, normalize ? shape / (M_PI * spread) : 1.0};
+    evaluate_kernel(k, r, out, n);
+
+  } else if (family == "inverse_power"){
+    double distance_scale = kernel_parameter(parameters, "scale"), exponent = kernel_parameter(parameters, "exponent");
+    if (!(distance_scale > 0) || !(exponent > 0)) stop("scale and exponent must be positive");
+    if (normalize && !(exponent > 2)) stop("an inverse power kernel can only be normalised if its exponent is greater than 2");
+    inverse_power_kernel k = {distance_scale, exponent,
+                              normalize ? (exponent - 1) * (exponent - 2) / (2 * M_PI * distance_scale * distance_scale) : 1.0};
+    evaluate_kernel(k, r, out, n);
+
+  } else if (family == "tabulated"){
+    NumericVector distances = kernel["distances"], values = kernel["values"];
+    if (distances.size() < 1 || distances.size() != values.size()){
+      stop("a tabulated kernel needs a value for each of at least one distance");
+    }
+    for (int i = 1; i < distances.size(); i++){
+      if (!(distances[i] > distances[i - 1])) stop("the distances of a tabulated kernel must be increasing");
+    }
+    tabulated_kernel k = {distances.begin(), values.begin(), (int) distances.size()};
+    evaluate_kernel(k, r, out, n);
+
+  } else {
+    stop("unknown dispersal kernel family '%s'", family);
+  }
+
+  return value;
+}
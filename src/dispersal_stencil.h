@@ -0,0 +1,176 @@
+#ifndef STEPS_DISPERSAL_STENCIL_H
+#define STEPS_DISPERSAL_STENCIL_H
+
+#include <Rcpp.h>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+/*
+** dispersal_stencil: the packed list of source offsets (relative to a sink
+**            pixel) that lie within the dispersal distance, together with
+**            the dispersal kernel value for each of them.
+**
+** Offsets are stored in exactly the order the original (2d+1)^2 box search
+** visits them (rows outer, columns inner) so that the sequence of random
+** draws - and therefore the dispersal outcome - is unchanged. The linear
+** offsets are only valid for the number of rows the stencil was built for.
+**
+** A stencil built for skip sampling is walked in reverse instead, skipping
+** between candidate sources with an exponential clock (see
+** skip_dispersal_stencil), and keeps the hazard -log(1 - weight) of each
+** offset (and of each kernel value) for it.
+*/
+struct dispersal_stencil {
+  int distance;
+  int nrows;
+  std::vector<int> dx;         // row offset of the source from the sink.
+  std::vector<int> dy;         // column offset of the source from the sink.
+  std::vector<int> offset;     // linear (column-major) offset, dx + dy * nrows.
+  std::vector<int> ring;       // rounded distance between sink and source (1..distance).
+  std::vector<double> weight;  // dispersal_kernel[ring - 1].
+  std::vector<double> kernel;  // the dispersal kernel at rounded distances 1..distance.
+  bool skip;                   // walked by skip sampling.
+  std::vector<double> hazard;         // -log(1 - weight), for skip sampling.
+  std::vector<double> kernel_hazard;  // -log(1 - kernel), for skip sampling.
+
+  dispersal_stencil() : distance(-1), nrows(0), skip(false) {}
+
+  int size() const { return (int) dx.size(); }
+
+  /* the kernel value at a rounded distance, or 0 for an unreachable source (ring 0) */
+  double ring_weight(int ring) const { return ring > 0 ? kernel[ring - 1] : 0.0; }
+  double ring_hazard(int ring) const { return ring > 0 ? kernel_hazard[ring - 1] : 0.0; }
+
+  /* Can the whole stencil be applied around pixel (i, j) without bounds checks? */
+  bool is_interior(int i, int j, int ncols) const {
+    return (i - distance >= 0) && (i + distance < nrows) &&
+      (j - distance >= 0) && (j + distance < ncols);
+  }
+};
+
+/* the hazard of a colonisation probability: a candidate with probability p is
+** proposed when an exponential clock runs out within it (0 for p <= 0 or NA) */
+inline double colonisation_hazard(double p){
+  if (!(p > 0)) return 0.0;
+  return (p >= 1) ? R_PosInf : -std::log1p(-p);
+}
+
+inline dispersal_stencil build_dispersal_stencil(int dispersal_distance,
+                                                 const Rcpp::NumericVector& dispersal_kernel,
+                                                 int nrows, bool skip_sampling = false){
+  dispersal_stencil stencil;
+  stencil.distance = dispersal_distance;
+  stencil.nrows = nrows;
+  stencil.skip = skip_sampling;
+
+  if (dispersal_distance > dispersal_kernel.size()){
+    Rcpp::stop("the dispersal kernel must have a value for each cell up to the dispersal distance");
+  }
+
+  stencil.kernel.assign(dispersal_kernel.begin(), dispersal_kernel.begin() + std::max(dispersal_distance, 0));
+
+  int k, l, real_distance;
+  for (k = -dispersal_distance; k <= dispersal_distance; k++){
+    for (l = -dispersal_distance; l <= dispersal_distance; l++){
+      real_distance = round(sqrt((double) (k * k + l * l)));
+      if ((real_distance > 0) && (real_distance <= dispersal_distance)){
+        stencil.dx.push_back(k);
+        stencil.dy.push_back(l);
+        stencil.offset.push_back(k + l * nrows);
+        stencil.ring.push_back(real_distance);
+        stencil.weight.push_back(dispersal_kernel[real_distance - 1]);
+      }
+    }
+  }
+  if (skip_sampling){
+    for (k = 0; k < stencil.size(); k++) stencil.hazard.push_back(colonisation_hazard(stencil.weight[k]));
+    for (k = 0; k < (int) stencil.kernel.size(); k++) stencil.kernel_hazard.push_back(colonisation_hazard(stencil.kernel[k]));
+  }
+  return stencil;
+}
+
+/*
+** dispersal_frontier: the set of sink pixels that have at least one occupied
+**            source pixel within the dispersal distance (the occupied cells
+**            dilated by the stencil). Each pixel keeps a count of the sources
+**            covering it, so sources can be added or removed incrementally,
+**            and the covered pixels are visited in the same row-major order
+**            as the full scan. Sinks outside the frontier have no candidate
+**            source, so skipping them does not change the dispersal outcome.
+*/
+struct row_major_order {
+  int nrows;
+  bool operator()(int a, int b) const {
+    int row_a = a % nrows, row_b = b % nrows;
+    return (row_a < row_b) || ((row_a == row_b) && (a < b));
+  }
+};
+
+struct dispersal_frontier {
+  int nrows;
+  int ncols;
+  std::vector<int> coverage;  // number of occupied sources within reach of each pixel.
+  std::vector<int> active;    // pixels with coverage > 0 (possibly stale until compacted).
+  bool needs_sorting;
+
+  dispersal_frontier(int nr, int nc) :
+    nrows(nr), ncols(nc), coverage(nr * nc, 0), needs_sorting(false) {}
+
+  /* Add (delta = 1) or remove (delta = -1) the source at cell from the frontier. */
+  void update(const dispersal_stencil& stencil, int cell, int delta){
+    int n, k, l, sink;
+    int source_x = cell % nrows;
+    int source_y = cell / nrows;
+    for (n = 0; n < stencil.size(); n++){
+      k = source_x - stencil.dx[n];
+      l = source_y - stencil.dy[n];
+      if ((k < 0) || (k >= nrows) || (l < 0) || (l >= ncols)) continue;
+      sink = k + l * nrows;
+      coverage[sink] += delta;
+      if (delta > 0 && coverage[sink] == delta){
+        active.push_back(sink);
+        needs_sorting = true;
+      }
+    }
+  }
+
+  /* Rebuild the frontier of all pixels with a positive, non-NA population, reusing storage. */
+  void reset(const dispersal_stencil& stencil, const Rcpp::NumericMatrix& population){
+    nrows = population.nrow();
+    ncols = population.ncol();
+    coverage.assign(nrows * ncols, 0);
+    active.clear();
+    needs_sorting = false;
+    const double* values = population.begin();
+    for (int cell = 0; cell < nrows * ncols; cell++){
+      if (values[cell] > 0) update(stencil, cell, 1);
+    }
+    compact();
+  }
+
+  /* Drop pixels no longer covered by any source and restore the visiting order. */
+  void compact(){
+    int n, kept = 0;
+    for (n = 0; n < (int) active.size(); n++){
+      if (coverage[active[n]] > 0) active[kept++] = active[n];
+    }
+    active.resize(kept);
+    if (needs_sorting){
+      row_major_order order = {nrows};
+      std::sort(active.begin(), active.end(), order);
+      active.erase(std::unique(active.begin(), active.end()), active.end());
+      needs_sorting = false;
+    }
+  }
+};
+
+/* Build the frontier of all pixels with a positive, non-NA population. */
+inline dispersal_frontier build_dispersal_frontier(const dispersal_stencil& stencil,
+                                                   const Rcpp::NumericMatrix& population){
+  dispersal_frontier frontier(population.nrow(), population.ncol());
+  frontier.reset(stencil, population);
+  return frontier;
+}
+
+#endif
@@ -0,0 +1,100 @@
+#include <Rcpp.h>
+#include <vector>
+using namespace Rcpp;
+
+/*
+** A sliding window product of disturbance layers, for disturbance_fires().
+**
+** The habitat at timestep t is scaled by the product of the disturbance layers
+** from t - effect_time + 1 to t. Rather than multiplying all of them again at
+** each timestep, the window keeps the running product of each cell's non-zero,
+** non-NA values, with counts of its zeros and NAs: a layer enters the window by
+** multiplying (or counting) its values in, and leaves by dividing (or
+** uncounting) them out, so exact zeros and NAs leave the window correctly and
+** each timestep costs two layers whatever the effect time.
+**
+** The window covers the layers after start, up to timestep; R reads the layers
+** one at a time, so only the window itself is held in memory.
+*/
+class disturbance_window {
+public:
+  int start;
+  int timestep;
+  std::vector<double> product;
+  std::vector<int> zeros;
+  std::vector<int> missing;
+
+  disturbance_window(int n_cells, int start) :
+    start(start), timestep(start), product(n_cells, 1.0), zeros(n_cells, 0), missing(n_cells, 0) {}
+
+  /* multiply a layer into (direction 1) or out of (direction -1) the window */
+  void update(const NumericVector& layer, int direction){
+    int n = product.size();
+    for (int i = 0; i < n; i++){
+      double value = layer[i];
+      if (ISNAN(value)){
+        missing[i] += direction;
+      } else if (value == 0){
+        zeros[i] += direction;
+      } else if (direction > 0){
+        product[i] *= value;
+      } else {
+        product[i] /= value;
+      }
+    }
+  }
+
+  /* the product of the layers in the window for a cell */
+  double value(int i) const {
+    return missing[i] > 0 ? NA_REAL : zeros[i] > 0 ? 0.0 : product[i];
+  }
+};
+
+static disturbance_window* window_pointer(SEXP window){
+  if (TYPEOF(window) != EXTPTRSXP || R_ExternalPtrAddr(window) == NULL){
+    stop("the disturbance window is no longer valid");
+  }
+  return XPtr<disturbance_window>(window).get();
+}
+
+// //' create an empty disturbance window over n_cells cells, starting after layer start.
+// [[Rcpp::export]]
+SEXP rcpp_disturbance_window(int n_cells, int start){
+  XPtr<disturbance_window> window(new disturbance_window(n_cells, start), true);
+  return window;
+}
+
+// //' the first layer before the window, and the last layer in it (or NULL if the window isn't usable, e.g. after serialisation).
+// [[Rcpp::export]]
+SEXP rcpp_disturbance_window_span(SEXP window){
+  if (TYPEOF(window) != EXTPTRSXP || R_ExternalPtrAddr(window) == NULL) return R_NilValue;
+  disturbance_window* current = window_pointer(window);
+  return IntegerVector::create(Named("start") = current->start, Named("timestep") = current->timestep);
+}
+
+// //' move the window on by a timestep: the next layer enters it and (if it isn't NULL) the oldest leaves.
+// [[Rcpp::export]]
+void rcpp_disturbance_window_push(SEXP window, NumericVector entering, SEXP leaving){
+  disturbance_window* current = window_pointer(window);
+  NumericVector left = Rf_isNull(leaving) ? NumericVector(0) : NumericVector(leaving);
+  int n_cells = current->product.size();
+  if (entering.size() != n_cells || (!Rf_isNull(leaving) && left.size() != n_cells)){
+    stop("disturbance layers must have a value for every cell of the habitat");
+  }
+  current->update(entering, 1);
+  if (!Rf_isNull(leaving)){
+    current->update(left, -1);
+    current->start++;
+  }
+  current->timestep++;
+}
+
+// //' the product of the layers in the window for each cell.
+// [[Rcpp::export]]
+NumericVector rcpp_disturbance_window_product(SEXP window){
+  disturbance_window* current = window_pointer(window);
+  int n = current->product.size();
+  NumericVector product(n);
+  for (int i = 0; i < n; i++) product[i] = current->value(i);
+  return product;
+}
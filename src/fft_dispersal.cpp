@@ -0,0 +1,251 @@
+#include <Rcpp.h>
+#include <vector>
+#include <complex>
+#include <cmath>
+#include "random_streams.h"
+using namespace Rcpp;
+
+/*
+** Kernel-based dispersal by FFT: the landscape is embedded in a torus whose
+** dimensions are powers of two (see extend() on the R side), so dispersing a
+** population through the (block-circulant) dispersal matrix is a circular
+** convolution of the population with the kernel. The convolution is computed
+** with real-to-complex transforms, and the spectrum of the kernel is computed
+** once per plan and reused for every stage, timestep and replicate.
+*/
+
+typedef std::complex<double> complex_t;
+
+/* Radix-2 complex FFT of a fixed (power of two) length. */
+struct fft_radix2 {
+  int n;
+  std::vector<complex_t> twiddle;  // exp(-2 pi i k / n), k < n / 2.
+  std::vector<int> reversed;       // bit-reversed index of each position.
+
+  fft_radix2(int length = 1) : n(length) {
+    int k, bits = 0;
+    while ((1 << bits) < n) bits++;
+    twiddle.resize(n / 2);
+    for (k = 0; k < n / 2; k++) twiddle[k] = std::polar(1.0, -2.0 * M_PI * k / n);
+    reversed.resize(n);
+    for (k = 0; k < n; k++){
+      int r = 0;
+      for (int b = 0; b < bits; b++) if (k & (1 << b)) r |= 1 << (bits - 1 - b);
+      reversed[k] = r;
+    }
+  }
+
+  /* in-place, unnormalised; inverse = true uses exp(+2 pi i k / n). */
+  void transform(complex_t* x, bool inverse) const {
+    int k, size, half, step, start;
+    for (k = 0; k < n; k++) if (k < reversed[k]) std::swap(x[k], x[reversed[k]]);
+    for (size = 2; size <= n; size *= 2){
+      half = size / 2;
+      step = n / size;
+      for (start = 0; start < n; start += size){
+        for (k = 0; k < half; k++){
+          complex_t w = inverse ? std::conj(twiddle[k * step]) : twiddle[k * step];
+          complex_t t = w * x[start + k + half];
+          x[start + k + half] = x[start + k] - t;
+          x[start + k] += t;
+        }
+      }
+    }
+  }
+};
+
+/*
+** fft_dispersal_plan: transforms for an nrows_torus x ncols_torus torus and the
+**            spectrum of the dispersal kernel on it. The landscape occupies
+**            rows row_offset + (0:(nrows - 1)) and columns col_offset + (0:(ncols - 1)).
+**
+** Columns (nrows_torus values, contiguous) are transformed real-to-complex with
+** a half-length complex FFT, leaving nrows_torus / 2 + 1 frequencies per column;
+** rows of the resulting half spectrum are then transformed with a full complex FFT.
+*/
+struct fft_dispersal_plan {
+  int nrows, ncols;
+  int nrows_torus, ncols_torus, row_offset, col_offset;
+  int n_freq;                              // nrows_torus / 2 + 1
+  fft_radix2 column_fft, row_fft;
+  std::vector<complex_t> column_twiddle;   // exp(-2 pi i k / nrows_torus), k <= nrows_torus / 2.
+  std::vector<complex_t> kernel_spectrum;  // n_freq x ncols_torus.
+  std::vector<complex_t> spectrum, buffer;
+  std::vector<double> torus;
+
+  fft_dispersal_plan(const NumericMatrix& kernel, int row_offset, int col_offset, int nrows, int ncols) :
+    nrows(nrows), ncols(ncols), nrows_torus(kernel.nrow()), ncols_torus(kernel.ncol()),
+    row_offset(row_offset), col_offset(col_offset), n_freq(kernel.nrow() / 2 + 1),
+    column_fft(std::max(kernel.nrow() / 2, 1)), row_fft(kernel.ncol()) {
+
+    column_twiddle.resize(n_freq);
+    for (int k = 0; k < n_freq; k++) column_twiddle[k] = std::polar(1.0, -2.0 * M_PI * k / nrows_torus);
+    spectrum.resize(n_freq * ncols_torus);
+    buffer.resize(std::max(n_freq, ncols_torus));
+    torus.assign(kernel.begin(), kernel.end());
+    forward();
+    kernel_spectrum = spectrum;
+  }
+
+  /* torus -> spectrum */
+  void forward(){
+    int half = nrows_torus / 2, j, k;
+    for (j = 0; j < ncols_torus; j++){
+      const double* column = &torus[j * nrows_torus];
+      complex_t* out = &spectrum[j * n_freq];
+      for (k = 0; k < half; k++) buffer[k] = complex_t(column[2 * k], column[2 * k + 1]);
+      column_fft.transform(&buffer[0], false);
+      for (k = 0; k < n_freq; k++){
+        complex_t z = buffer[k % half];
+        complex_t z_mirror = std::conj(buffer[(half - k) % half]);
+        complex_t even = 0.5 * (z + z_mirror);
+        complex_t odd = complex_t(0, -0.5) * (z - z_mirror);
+        out[k] = even + column_twiddle[k] * odd;
+      }
+    }
+    transform_rows(false);
+  }
+
+  /* spectrum -> torus (normalised) */
+  void inverse(){
+    int half = nrows_torus / 2, j, k;
+    double scale = 1.0 / ((double) nrows_torus * ncols_torus);
+    transform_rows(true);
+    for (j = 0; j < ncols_torus; j++){
+      const complex_t* in = &spectrum[j * n_freq];
+      double* column = &torus[j * nrows_torus];
+      for (k = 0; k < half; k++){
+        complex_t x = in[k];
+        complex_t x_mirror = std::conj(in[half - k]);
+        complex_t even = 0.5 * (x + x_mirror);
+        complex_t odd = 0.5 * (x - x_mirror) / column_twiddle[k];
+        buffer[k] = even + complex_t(0, 1) * odd;
+      }
+      column_fft.transform(&buffer[0], true);
+      for (k = 0; k < half; k++){
+        column[2 * k] = 2.0 * scale * buffer[k].real();
+        column[2 * k + 1] = 2.0 * scale * buffer[k].imag();
+      }
+    }
+  }
+
+  void transform_rows(bool inverse){
+    int j, k;
+    for (k = 0; k < n_freq; k++){
+      for (j = 0; j < ncols_torus; j++) buffer[j] = spectrum[k + j * n_freq];
+      row_fft.transform(&buffer[0], inverse);
+      for (j = 0; j < ncols_torus; j++) spectrum[k + j * n_freq] = buffer[j];
+    }
+  }
+
+  /* Disperse one landscape (nrows x ncols, column-major) through the kernel, in place on the torus. */
+  void convolve(const double* population){
+    int i, j, n;
+    std::fill(torus.begin(), torus.end(), 0.0);
+    for (j = 0; j < ncols; j++){
+      for (i = 0; i < nrows; i++){
+        double value = population[i + j * nrows];
+        if (!R_IsNA(value) && !R_IsNaN(value)) torus[(row_offset + i) + (col_offset + j) * nrows_torus] = value;
+      }
+    }
+    forward();
+    for (n = 0; n < (int) spectrum.size(); n++) spectrum[n] *= kernel_spectrum[n];
+    inverse();
+  }
+};
+
+// //' create an FFT dispersal plan from the dispersal kernel evaluated on the torus.
+// //' @param kernel the (normalised) kernel as a matrix of torus rows x torus columns, both powers of two.
+// //' @param row_offset,col_offset zero-based position of the landscape on the torus.
+// //' @param nrows,ncols dimensions of the landscape.
+// [[Rcpp::export]]
+SEXP rcpp_fft_plan(NumericMatrix kernel, int row_offset, int col_offset, int nrows, int ncols){
+  int nrows_torus = kernel.nrow(), ncols_torus = kernel.ncol();
+  if ((nrows_torus & (nrows_torus - 1)) || (ncols_torus & (ncols_torus - 1)) || nrows_torus < 2){
+    stop("the torus dimensions must be powers of two");
+  }
+  if (row_offset < 0 || col_offset < 0 || row_offset + nrows > nrows_torus || col_offset + ncols > ncols_torus){
+    stop("the landscape must fit within the torus");
+  }
+  XPtr<fft_dispersal_plan> plan(new fft_dispersal_plan(kernel, row_offset, col_offset, nrows, ncols), true);
+  return plan;
+}
+
+// //' is plan a usable FFT dispersal plan for a landscape of this size? (plans do not survive serialisation)
+// [[Rcpp::export]]
+bool rcpp_fft_plan_valid(SEXP plan, int nrows, int ncols){
+  if (TYPEOF(plan) != EXTPTRSXP || R_ExternalPtrAddr(plan) == NULL) return false;
+  XPtr<fft_dispersal_plan> fft_plan(plan);
+  return fft_plan->nrows == nrows && fft_plan->ncols == ncols;
+}
+
+// //' the deterministic part of FFT dispersal: the circular convolution of each stage with the kernel, on the cells of the landscape.
+// //' @param plan a plan created by rcpp_fft_plan.
+// //' @param population a cells x stages matrix, with cells in the (column-major) order of the landscape.
+// [[Rcpp::export]]
+NumericMatrix rcpp_fft_convolution(SEXP plan, NumericMatrix population){
+  XPtr<fft_dispersal_plan> fft_plan(plan);
+  int n_cells = fft_plan->nrows * fft_plan->ncols;
+  int n_stages = population.ncol();
+  int stage, i, j;
+  NumericMatrix convolved(n_cells, n_stages);
+
+  if (population.nrow() != n_cells) stop("the population must have one row per cell of the landscape");
+
+  for (stage = 0; stage < n_stages; stage++){
+    fft_plan->convolve(population.begin() + stage * n_cells);
+    for (j = 0; j < fft_plan->ncols; j++){
+      for (i = 0; i < fft_plan->nrows; i++){
+        convolved(i + j * fft_plan->nrows, stage) =
+          fft_plan->torus[(fft_plan->row_offset + i) + (fft_plan->col_offset + j) * fft_plan->nrows_torus];
+      }
+    }
+  }
+
+  return convolved;
+}
+
+// //' disperse a batch of stages by FFT and redistribute the individuals with a multinomial draw.
+// //' @param plan a plan created by rcpp_fft_plan.
+// //' @param population a cells x stages matrix, with cells in the (column-major) order of the landscape.
+// //' @return the cells x stages matrix of dispersed populations. NA cells stay NA and receive no individuals.
+// [[Rcpp::export]]
+NumericMatrix rcpp_fft_dispersal(SEXP plan, NumericMatrix population){
+  XPtr<fft_dispersal_plan> fft_plan(plan);
+  int n_cells = fft_plan->nrows * fft_plan->ncols;
+  int n_stages = population.ncol();
+  int stage, i, j, cell;
+  double total;
+  std::vector<double> arrivals(n_cells), counts(n_cells);
+  NumericMatrix dispersed_population(n_cells, n_stages);
+  r_stream rng;
+
+  if (population.nrow() != n_cells) stop("the population must have one row per cell of the landscape");
+
+  for (stage = 0; stage < n_stages; stage++){
+    const double* current = population.begin() + stage * n_cells;
+    double* dispersed = dispersed_population.begin() + stage * n_cells;
+
+    fft_plan->convolve(current);
+
+    /* extract the landscape from the torus; individuals can't arrive in NA cells */
+    total = 0.0;
+    for (j = 0; j < fft_plan->ncols; j++){
+      for (i = 0; i < fft_plan->nrows; i++){
+        cell = i + j * fft_plan->nrows;
+        double value = fft_plan->torus[(fft_plan->row_offset + i) + (fft_plan->col_offset + j) * fft_plan->nrows_torus];
+        bool missing = R_IsNA(current[cell]) || R_IsNaN(current[cell]);
+        arrivals[cell] = (missing || !(value > 0)) ? 0.0 : value;
+        if (!missing) total += current[cell];
+      }
+    }
+
+    /* make sure none are lost or gained */
+    rng_multinom(rng, std::floor(total), &arrivals[0], n_cells, &counts[0]);
+    for (cell = 0; cell < n_cells; cell++){
+      dispersed[cell] = (R_IsNA(current[cell]) || R_IsNaN(current[cell])) ? NA_REAL : counts[cell];
+    }
+  }
+
+  return dispersed_population;
+}
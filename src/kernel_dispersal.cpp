@@ -0,0 +1,127 @@
+#include <Rcpp.h>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+using namespace Rcpp;
+
+/*
+** Kernel-based dispersal over a truncated neighbourhood: each populated cell
+** spreads its individuals over the cells within the kernel's cutoff radius that
+** can receive individuals, in proportion to kernel weight x arrival probability.
+**
+** Distances between cells of a regular grid only depend on the offset between
+** them, so the neighbour list is the same for every source cell: it is held
+** once as a list of (row, column) offsets and kernel weights (i.e. every row of
+** the sparse source x sink matrix shares one set of column offsets and values),
+** in row-major order so that sinks are visited in raster cell order.
+**
+** Cells are numbered as in raster (row-major: cell = row * ncols + col).
+*/
+
+/* Round contributions to integers, keeping the total (rounded) and giving the
+** spare individuals to the sinks with the largest remainders (ties go to later
+** sinks, as with order() in R). */
+static void round_largest_remainder(std::vector<double>& contribution, std::vector<int>& order){
+  int n = contribution.size(), k;
+  long double total = 0, total_floor = 0;
+  std::vector<double> remainder(n);
+  for (k = 0; k < n; k++){
+    total += contribution[k];
+    double whole = std::floor(contribution[k]);
+    remainder[k] = contribution[k] - whole;
+    contribution[k] = whole;
+    total_floor += whole;
+  }
+  int spare = (int) (std::nearbyint((double) total) - (double) total_floor);
+  if (spare <= 0) return;
+  order.resize(n);
+  for (k = 0; k < n; k++) order[k] = k;
+  std::stable_sort(order.begin(), order.end(),
+                   [&remainder](int a, int b) { return remainder[a] < remainder[b]; });
+  for (k = std::max(n - spare, 0); k < n; k++) contribution[order[k]] += 1;
+}
+
+// //' disperse populations through a truncated dispersal kernel.
+// //' @param offset_row,offset_col,weight the neighbourhood: row and column offsets (row-major order) and kernel values.
+// //' @param nrows,ncols dimensions of the landscape.
+// //' @param population a cells x stages matrix of populations, cells in raster (row-major) order.
+// //' @param arrival_probability per-cell arrival probabilities; only cells with a positive value can receive individuals.
+// //' @param demo_stoch should contributions be rounded to whole individuals?
+// //' @return the cells x stages matrix of populations after dispersal. Cells that can't receive individuals are emptied, unless their individuals have nowhere to go.
+// [[Rcpp::export]]
+NumericMatrix rcpp_kernel_dispersal(IntegerVector offset_row, IntegerVector offset_col, NumericVector weight,
+                                    int nrows, int ncols, NumericMatrix population,
+                                    NumericVector arrival_probability, bool demo_stoch = false){
+  int n_cells = nrows * ncols;
+  int n_offsets = weight.size();
+  int n_stages = population.ncol();
+  int stage, source, row, col, n, k, sink;
+  long double total;
+
+  if (population.nrow() != n_cells || arrival_probability.size() != n_cells){
+    stop("the population and arrival probabilities must have one value per cell of the landscape");
+  }
+  if (offset_row.size() != n_offsets || offset_col.size() != n_offsets){
+    stop("the neighbourhood offsets and weights must have the same length");
+  }
+
+  std::vector<bool> can_arrive(n_cells);
+  for (sink = 0; sink < n_cells; sink++){
+    can_arrive[sink] = (arrival_probability[sink] > 0) && !R_IsNA(arrival_probability[sink]);
+  }
+
+  NumericMatrix dispersed_population = clone(population);
+  std::vector<long double> arrivals(n_cells);
+  std::vector<int> sinks, order;
+  std::vector<double> contribution;
+
+  for (stage = 0; stage < n_stages; stage++){
+    const double* current = population.begin() + stage * n_cells;
+    double* dispersed = dispersed_population.begin() + stage * n_cells;
+    std::fill(arrivals.begin(), arrivals.end(), 0.0L);
+
+    for (source = 0; source < n_cells; source++){
+      if (!(current[source] > 0)) continue;
+      row = source / ncols;
+      col = source % ncols;
+
+      /* weights of the sinks this source can reach */
+      sinks.clear();
+      contribution.clear();
+      total = 0;
+      for (n = 0; n < n_offsets; n++){
+        int sink_row = row + offset_row[n];
+        int sink_col = col + offset_col[n];
+        if (sink_row < 0 || sink_row >= nrows || sink_col < 0 || sink_col >= ncols) continue;
+        sink = sink_row * ncols + sink_col;
+        if (!can_arrive[sink]) continue;
+        sinks.push_back(sink);
+        contribution.push_back(weight[n] * arrival_probability[sink]);
+        total += contribution.back();
+      }
+
+      /* individuals with nowhere to go stay where they are */
+      if (!(total > 0)){
+        if (can_arrive[source]) arrivals[source] += current[source];
+        continue;
+      }
+
+      /* standardise contributions and round them if demo_stoch = TRUE */
+      for (k = 0; k < (int) contribution.size(); k++){
+        contribution[k] = contribution[k] / (double) total;
+        contribution[k] = contribution[k] * current[source];
+      }
+      if (demo_stoch) round_largest_remainder(contribution, order);
+      for (k = 0; k < (int) sinks.size(); k++) arrivals[sinks[k]] += contribution[k];
+
+      /* a source that can't receive individuals is left empty once they leave */
+      if (!can_arrive[source]) dispersed[source] = 0;
+    }
+
+    for (sink = 0; sink < n_cells; sink++){
+      if (can_arrive[sink]) dispersed[sink] = (double) arrivals[sink];
+    }
+  }
+
+  return dispersed_population;
+}
@@ -0,0 +1,232 @@
+#include <Rcpp.h>
+#include <vector>
+#include <string>
+#include "landscape_state.h"
+using namespace Rcpp;
+
+/*
+** Creating, reading and updating the native landscape state (see
+** landscape_state.h). Built-in dynamics work on it in place; the R side
+** (sync_landscape() and materialise_state()) keeps it in step with the rasters.
+*/
+
+// //' create a native landscape state.
+// //' @param cells the (one-based) raster cell numbers of the non-NA cells.
+// //' @param nrows,ncols dimensions of the landscape.
+// //' @param population a cells x stages matrix of the population in those cells.
+// //' @param compact should the population be kept as whole numbers, and the habitat layers in single precision?
+// [[Rcpp::export]]
+SEXP rcpp_landscape_state(IntegerVector cells, int nrows, int ncols, NumericMatrix population, bool compact = false){
+  XPtr<landscape_state> landscape(new landscape_state(cells, nrows, ncols, population, compact), true);
+  return landscape;
+}
+
+// //' is landscape a usable landscape state? (landscape states do not survive serialisation)
+// [[Rcpp::export]]
+bool rcpp_landscape_valid(SEXP landscape){
+  return TYPEOF(landscape) == EXTPTRSXP && R_ExternalPtrAddr(landscape) != NULL;
+}
+
+// //' the cells x stages matrix of the population in the non-NA cells.
+// [[Rcpp::export]]
+NumericMatrix rcpp_landscape_population(SEXP landscape){
+  landscape_state* state = landscape_pointer(landscape);
+  NumericMatrix population(state->size(), state->n_stages);
+  state->read_population(population.begin());
+  return population;
+}
+
+// //' replace the population in the non-NA cells with a cells x stages matrix.
+// [[Rcpp::export]]
+void rcpp_landscape_set_population(SEXP landscape, NumericMatrix population){
+  landscape_state* state = landscape_pointer(landscape);
+  if (population.nrow() != state->size() || population.ncol() != state->n_stages){
+    stop("the population must have one row per non-NA cell and one column per stage");
+  }
+  state->write_population(population.begin());
+}
+
+/* one-based stages, checked against the landscape's stages */
+static std::vector<int> landscape_stages(const landscape_state& landscape, const IntegerVector& stages){
+  for (int s = 0; s < stages.size(); s++){
+    if (stages[s] < 1 || stages[s] > landscape.n_stages) stop("stages must be between 1 and the number of stages");
+  }
+  return std::vector<int>(stages.begin(), stages.end());
+}
+
+/*
+** total population over the given (checked) one-based stages, or all stages
+** if there are none, in each cell. It doesn't call R, so that replicate steps
+** can use it on worker threads.
+*/
+static std::vector<long double> population_totals(const landscape_state& landscape, const std::vector<int>& stages){
+  int n_cells = landscape.size(), n_stages = stages.empty() ? landscape.n_stages : stages.size(), i, s;
+  std::vector<long double> totals(n_cells, 0.0);
+  std::vector<double> buffer;
+  for (s = 0; s < n_stages; s++){
+    const double* population = landscape.stage_values(stages.empty() ? s : stages[s] - 1, buffer);
+    for (i = 0; i < n_cells; i++) totals[i] += population[i];
+  }
+  return totals;
+}
+
+// //' total population (over the given one-based stages, or all stages if empty) in each non-NA cell.
+// [[Rcpp::export]]
+NumericVector rcpp_landscape_population_totals(SEXP landscape, IntegerVector stages = IntegerVector(0)){
+  landscape_state* state = landscape_pointer(landscape);
+  std::vector<long double> totals = population_totals(*state, landscape_stages(*state, stages));
+  return NumericVector(totals.begin(), totals.end());
+}
+
+// //' set a habitat layer from its values in all cells of the landscape (or a single value).
+// [[Rcpp::export]]
+void rcpp_landscape_set_layer(SEXP landscape, std::string name, NumericVector values){
+  landscape_pointer(landscape)->set_layer(name, values);
+}
+
+// //' the values of a habitat layer in the non-NA cells.
+// [[Rcpp::export]]
+NumericVector rcpp_landscape_layer(SEXP landscape, std::string name){
+  const habitat_layer& values = landscape_pointer(landscape)->layer(name);
+  NumericVector cell_values(values.size());
+  for (int i = 0; i < values.size(); i++) cell_values[i] = values[i];
+  return cell_values;
+}
+
+/*
+** Scale the population of each cell down to the carrying capacity (a habitat
+** layer). Only the given (checked, one-based) stages count towards it, but all
+** stages are scaled.
+*/
+static void scale_to_capacity(landscape_state& landscape, const habitat_layer& carrying_capacity,
+                              const std::vector<int>& stages){
+  std::vector<long double> totals = population_totals(landscape, stages);
+  int n_cells = landscape.size(), i, s;
+  std::vector<double> scale(n_cells);
+
+  /* as K / total, with 0 / 0 giving 0 and at most 1; NA if either is NA */
+  for (i = 0; i < n_cells; i++){
+    double total = (double) totals[i];
+    if (R_IsNA(carrying_capacity[i]) || R_IsNA(total)){
+      scale[i] = NA_REAL;
+    } else {
+      double overpopulation = carrying_capacity[i] / total;
+      if (R_IsNaN(overpopulation)) overpopulation = 0.0;
+      scale[i] = std::min(overpopulation, 1.0);
+    }
+  }
+
+  for (s = 0; s < landscape.n_stages; s++) landscape.scale_stage(s, scale.data());
+}
+
+void landscape_density_dependence(landscape_state& landscape, const std::string& capacity_layer,
+                                  const IntegerVector& stages){
+  scale_to_capacity(landscape, landscape.layer(capacity_layer), landscape_stages(landscape, stages));
+}
+
+/*
+** Density dependence for replicates: the capacity layer and stages are checked
+** (and the stages copied out of R) once, so that run() never calls R.
+*/
+class replicate_density : public replicate_step {
+public:
+  replicate_density(const landscape_state& landscape, const std::string& capacity_layer, const IntegerVector& stages) :
+    capacity_layer(capacity_layer), stages(landscape_stages(landscape, stages)) {
+    landscape.layer(capacity_layer);
+  }
+
+  void run(landscape_state& landscape, uint64_t, int){
+    scale_to_capacity(landscape, landscape.layer(capacity_layer), stages);
+  }
+
+private:
+  std::string capacity_layer;
+  std::vector<int> stages;
+};
+
+std::unique_ptr<replicate_step> replicate_density_dependence(const landscape_state& landscape,
+                                                             const std::string& capacity_layer,
+                                                             const IntegerVector& stages){
+  return std::unique_ptr<replicate_step>(new replicate_density(landscape, capacity_layer, stages));
+}
+
+/* Fractions to scale fecundity and survival by must keep survival rates valid. */
+static void check_fractions(double fecundity_fraction, double survival_fraction){
+  if (!(fecundity_fraction >= 0 && fecundity_fraction <= 1 && survival_fraction >= 0 && survival_fraction <= 1)){
+    stop("fecundity_fraction and survival_fraction must be between 0 and 1");
+  }
+}
+
+/*
+** Density dependence in the demography: if the population of any cell is
+** above its carrying capacity (a habitat layer), the fecundities and survivals
+** of the next stage projection are scaled by the given fractions - in the cells
+** above capacity for local transition matrices, or in every cell for a global
+** one. The fractions are kept as per-cell multipliers (see landscape_state).
+*/
+static void scale_demography(landscape_state& landscape, const habitat_layer& carrying_capacity,
+                             double fecundity_fraction, double survival_fraction, bool local){
+  std::vector<long double> totals = population_totals(landscape, std::vector<int>());
+  int n_cells = landscape.size(), i;
+  bool any_over = false;
+
+  landscape.fecundity_scale.assign(n_cells, 1.0);
+  landscape.survival_scale.assign(n_cells, 1.0);
+  for (i = 0; i < n_cells; i++){
+    /* NA totals or capacities are never over */
+    if ((double) totals[i] > carrying_capacity[i]){
+      any_over = true;
+      if (local){
+        landscape.fecundity_scale[i] = fecundity_fraction;
+        landscape.survival_scale[i] = survival_fraction;
+      }
+    }
+  }
+
+  if (!any_over){
+    landscape.fecundity_scale.clear();
+    landscape.survival_scale.clear();
+  } else if (!local){
+    landscape.fecundity_scale.assign(n_cells, fecundity_fraction);
+    landscape.survival_scale.assign(n_cells, survival_fraction);
+  }
+}
+
+void landscape_demography_density_dependence(landscape_state& landscape, const std::string& capacity_layer,
+                                             double fecundity_fraction, double survival_fraction, bool local){
+  check_fractions(fecundity_fraction, survival_fraction);
+  scale_demography(landscape, landscape.layer(capacity_layer), fecundity_fraction, survival_fraction, local);
+}
+
+/*
+** Demography density dependence for replicates: the capacity layer and
+** fractions are checked once, so that run() never calls R.
+*/
+class replicate_demography_density : public replicate_step {
+public:
+  replicate_demography_density(const landscape_state& landscape, const std::string& capacity_layer,
+                               double fecundity_fraction, double survival_fraction, bool local) :
+    capacity_layer(capacity_layer), fecundity_fraction(fecundity_fraction), survival_fraction(survival_fraction),
+    local(local) {
+    landscape.layer(capacity_layer);
+    check_fractions(fecundity_fraction, survival_fraction);
+  }
+
+  void run(landscape_state& landscape, uint64_t, int){
+    scale_demography(landscape, landscape.layer(capacity_layer), fecundity_fraction, survival_fraction, local);
+  }
+
+private:
+  std::string capacity_layer;
+  double fecundity_fraction;
+  double survival_fraction;
+  bool local;
+};
+
+std::unique_ptr<replicate_step> replicate_demography_density_dependence(const landscape_state& landscape,
+                                                                         const std::string& capacity_layer,
+                                                                         double fecundity_fraction,
+                                                                         double survival_fraction, bool local){
+  return std::unique_ptr<replicate_step>(new replicate_demography_density(landscape, capacity_layer, fecundity_fraction,
+                                                                          survival_fraction, local));
+}
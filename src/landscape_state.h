@@ -0,0 +1,291 @@
+#ifndef STEPS_LANDSCAPE_STATE_H
+#define STEPS_LANDSCAPE_STATE_H
+
+#include <Rcpp.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <cmath>
+#include <stdint.h>
+
+/* populations of compact landscapes are whole numbers of individuals, with R's NA_INTEGER for NA */
+inline int32_t compact_count(double count){
+  if (ISNAN(count)) return NA_INTEGER;
+  if (count >= 2147483647.0) return 2147483647;
+  if (count <= -2147483647.0) return -2147483647;
+  return (int32_t) std::floor(count + 0.5);
+}
+
+inline double expand_count(int32_t count){
+  return count == NA_INTEGER ? NA_REAL : (double) count;
+}
+
+/*
+** habitat_layer: the values of a habitat layer in the non-NA cells of a
+**            landscape, in double precision, or in single precision for
+**            compact landscapes (where NA and NaN both read back as NA).
+*/
+class habitat_layer {
+public:
+  bool compact;
+
+  /* values for all cells of the landscape (raster order), or a single value for every cell */
+  habitat_layer(const Rcpp::NumericVector& values, const std::vector<int>& cells, bool compact) : compact(compact) {
+    size_t n = cells.size();
+    if (compact) single_values.resize(n); else double_values.resize(n);
+    for (size_t i = 0; i < n; i++){
+      double value = values[values.size() == 1 ? 0 : cells[i]];
+      if (compact) single_values[i] = (float) value; else double_values[i] = value;
+    }
+  }
+
+  int size() const { return compact ? single_values.size() : double_values.size(); }
+
+  double operator[](int i) const {
+    if (!compact) return double_values[i];
+    float value = single_values[i];
+    return value == value ? (double) value : NA_REAL;
+  }
+
+private:
+  std::vector<double> double_values;
+  std::vector<float> single_values;
+};
+
+/*
+** landscape_state: the non-NA cells of a landscape with their population and
+**            habitat layers, kept natively between dynamics so that the built-in
+**            dynamics can update them in place instead of extracting them from,
+**            and assigning them back to, the rasters.
+**
+** Cells are numbered as in raster (zero-based, row-major); grid() gives their
+** position in the (column-major) landscape matrices used by the dispersal
+** engines. The population is a cells x stages matrix (each stage contiguous),
+** and each habitat layer (e.g. habitat_suitability, carrying_capacity) holds
+** one value per cell. Layers are never changed in place, so copies of a
+** landscape state (e.g. one per replicate) share them.
+**
+** Compact landscapes hold the population as 32-bit whole numbers of
+** individuals (rounded whenever a dynamic changes it) and their habitat layers
+** in single precision, which halves the memory taken by the population of each
+** replicate and by the layers. The stage projection reads and writes the counts
+** directly; the other dynamics read and write the population a stage at a time
+** through stage_values(), scale_stage() and the stage scatter and gather, which
+** convert to and from double precision (dispersal, for instance, works on a
+** double precision grid per thread).
+**
+** Density dependence in the demography is kept as per-cell multipliers of the
+** fecundities (above the diagonal of the transition matrices) and survivals
+** (on and below it), which the next stage projection applies and clears, so
+** that the transition matrices are never rewritten just to scale them.
+*/
+class landscape_state {
+public:
+  int nrows;
+  int ncols;
+  int n_stages;
+  bool compact;
+  std::vector<int> cells;
+  std::vector<double> population;  // cells x stages, or empty if compact
+  std::vector<int32_t> counts;     // compact: cells x stages
+  std::map<std::string, std::shared_ptr<const habitat_layer> > layers;
+  std::vector<double> fecundity_scale;  // per cell, or empty for none
+  std::vector<double> survival_scale;
+
+  /* cell_numbers are one-based, as from which() in R */
+  landscape_state(const Rcpp::IntegerVector& cell_numbers, int nrows, int ncols, const Rcpp::NumericMatrix& initial_population,
+                  bool compact = false) :
+    nrows(nrows), ncols(ncols), n_stages(initial_population.ncol()), compact(compact),
+    cells(cell_numbers.begin(), cell_numbers.end()) {
+
+    if (initial_population.nrow() != (int) cells.size()){
+      Rcpp::stop("the population must have one row per non-NA cell");
+    }
+    for (size_t i = 0; i < cells.size(); i++){
+      cells[i]--;
+      if (cells[i] < 0 || cells[i] >= nrows * ncols) Rcpp::stop("cell numbers must be within the landscape");
+    }
+    if (compact) counts.resize(population_size()); else population.resize(population_size());
+    write_population(initial_population.begin());
+  }
+
+  int size() const { return cells.size(); }
+
+  size_t population_size() const { return cells.size() * n_stages; }
+
+  /* position of the i-th cell in a column-major nrows x ncols matrix */
+  int grid(int i) const { return cells[i] / ncols + (cells[i] % ncols) * nrows; }
+
+  /* the population of stage s: in place, or expanded into buffer if the landscape is compact */
+  const double* stage_values(int s, std::vector<double>& buffer) const {
+    if (!compact) return population.data() + (size_t) s * cells.size();
+    const int32_t* stage_counts = counts.data() + (size_t) s * cells.size();
+    buffer.resize(cells.size());
+    for (size_t i = 0; i < cells.size(); i++) buffer[i] = expand_count(stage_counts[i]);
+    return buffer.data();
+  }
+
+  /* multiply the population of stage s in each cell by scale */
+  void scale_stage(int s, const double* scale){
+    size_t offset = (size_t) s * cells.size();
+    if (!compact) for (size_t i = 0; i < cells.size(); i++) population[offset + i] *= scale[i];
+    else for (size_t i = 0; i < cells.size(); i++) counts[offset + i] = compact_count(expand_count(counts[offset + i]) * scale[i]);
+  }
+
+  /* copy the population to, or replace it with, a cells x stages array */
+  void read_population(double* values) const {
+    if (!compact) std::copy(population.begin(), population.end(), values);
+    else for (size_t i = 0; i < counts.size(); i++) values[i] = expand_count(counts[i]);
+  }
+
+  void write_population(const double* values){
+    if (!compact) std::copy(values, values + population.size(), population.begin());
+    else for (size_t i = 0; i < counts.size(); i++) counts[i] = compact_count(values[i]);
+  }
+
+  const habitat_layer& layer(const std::string& name) const {
+    std::map<std::string, std::shared_ptr<const habitat_layer> >::const_iterator found = layers.find(name);
+    if (found == layers.end()) Rcpp::stop("the landscape has no '" + name + "' layer");
+    return *found->second;
+  }
+
+  /* values for all cells of the landscape (raster order), or a single value for every cell */
+  void set_layer(const std::string& name, const Rcpp::NumericVector& values){
+    if (values.size() != 1 && values.size() != nrows * ncols){
+      Rcpp::stop("the '" + name + "' layer must have one value per cell of the landscape");
+    }
+    layers[name] = std::make_shared<const habitat_layer>(values, cells, compact);
+  }
+
+  /* write a habitat layer, or the population of stage s, into a landscape matrix, NA elsewhere */
+  void scatter(const habitat_layer& values, double* grid_values) const {
+    std::fill(grid_values, grid_values + nrows * ncols, NA_REAL);
+    for (int i = 0; i < size(); i++) grid_values[grid(i)] = values[i];
+  }
+
+  void scatter_stage(int s, double* grid_values) const {
+    size_t offset = (size_t) s * cells.size();
+    std::fill(grid_values, grid_values + nrows * ncols, NA_REAL);
+    if (!compact) for (int i = 0; i < size(); i++) grid_values[grid(i)] = population[offset + i];
+    else for (int i = 0; i < size(); i++) grid_values[grid(i)] = expand_count(counts[offset + i]);
+  }
+
+  /* read the population of stage s out of a landscape matrix */
+  void gather_stage(const double* grid_values, int s){
+    size_t offset = (size_t) s * cells.size();
+    if (!compact) for (int i = 0; i < size(); i++) population[offset + i] = grid_values[grid(i)];
+    else for (int i = 0; i < size(); i++) counts[offset + i] = compact_count(grid_values[grid(i)]);
+  }
+};
+
+/* the landscape state behind an external pointer (which do not survive serialisation) */
+inline landscape_state* landscape_pointer(SEXP landscape){
+  if (TYPEOF(landscape) != EXTPTRSXP || R_ExternalPtrAddr(landscape) == NULL){
+    Rcpp::stop("the landscape state is no longer valid");
+  }
+  return Rcpp::XPtr<landscape_state>(landscape).get();
+}
+
+/*
+** transition_matrices: a demography's transition matrices, as used by stage
+**            projections: a global stages x stages matrix, or a local matrix
+**            for every raster cell. Local matrices are a dense stages x stages
+**            x cells array, or compact: the positions of their non-zero
+**            elements (shared by every cell) and a cells x non-zero elements
+**            block of those elements' values, as made by build_demography().
+*/
+class transition_matrices {
+public:
+  bool local;
+  bool compact;
+  int n_stages;                // compact: the number of stages
+  Rcpp::NumericVector dense;   // the global matrix, or dense local matrices
+  std::vector<int> pattern;    // compact: zero-based positions of the non-zero elements
+  Rcpp::NumericMatrix values;  // compact: cells x non-zero elements
+
+  /* the (local, if it has them) transition matrices of a demography */
+  explicit transition_matrices(const Rcpp::List& demography);
+  /* a global matrix, or a dense array of local matrices */
+  transition_matrices(const Rcpp::NumericVector& matrices, bool local);
+
+  int n_matrices(int stages) const {
+    return compact ? values.nrow() : dense.size() / (stages * stages);
+  }
+
+  /* matrix m (column-major, stages x stages), expanded into expanded if it is compact */
+  const double* matrix(int m, int stages, double* expanded) const {
+    if (!compact) return dense.begin() + (size_t) m * stages * stages;
+    std::fill(expanded, expanded + stages * stages, 0.0);
+    int n_values = values.nrow();
+    for (size_t e = 0; e < pattern.size(); e++) expanded[pattern[e]] = values[m + e * n_values];
+    return expanded;
+  }
+
+  /* check the matrices are for the given number of stages */
+  void check(int stages) const;
+};
+
+/*
+** The built-in dynamics, which change a landscape state in place. Each is
+** defined with its engine, and they are run (from step descriptions made in R)
+** by landscape_step() in simulation_driver.cpp.
+*/
+void landscape_stage_projection(landscape_state& landscape, const transition_matrices& transitions, bool demo_stoch);
+void landscape_density_dependence(landscape_state& landscape, const std::string& capacity_layer,
+                                  const Rcpp::IntegerVector& stages);
+void landscape_demography_density_dependence(landscape_state& landscape, const std::string& capacity_layer,
+                                             double fecundity_fraction, double survival_fraction, bool local);
+void landscape_dispersal(landscape_state& landscape, const std::string& arrival_layer, const std::string& capacity_layer,
+                         Rcpp::NumericMatrix barriers_map, int barrier_type, bool use_barrier, int dispersal_steps,
+                         const Rcpp::IntegerVector& stages, const Rcpp::IntegerVector& dispersal_distance,
+                         const Rcpp::List& dispersal_kernel, const Rcpp::NumericVector& dispersal_proportion,
+                         bool use_frontier, double seed, int n_threads, SEXP workspace, bool skip_sampling);
+
+/*
+** replicate_step: a built-in dynamic prepared to run on the landscapes of many
+**            replicates at once. Everything that needs R (reading parameters,
+**            checking them, building stencils and barrier paths) is done when
+**            it is made, so run() never calls R and replicates can run on
+**            worker threads. Random numbers come from counter streams keyed on
+**            the given seed; thread is the worker (below the n_threads the step
+**            was made for), for steps that keep scratch buffers per thread.
+*/
+class replicate_step {
+public:
+  virtual ~replicate_step() {}
+  virtual void run(landscape_state& landscape, uint64_t seed, int thread) = 0;
+};
+
+/*
+** Steps prepared for many simulations (e.g. the scenarios of a sweep) can share
+** what they build: replicate_dispersal() takes its stencils, barrier paths,
+** landscape maps and scratch buffers from the given dispersal_artifacts (see
+** rcpp_dispersal_funs_v2.cpp), or builds its own if there are none. Given a
+** cache directory, artifacts also keep what their barrier paths find on disk
+** for later simulations, once save_dispersal_artifacts() is called.
+*/
+class dispersal_artifacts;
+std::shared_ptr<dispersal_artifacts> shared_dispersal_artifacts(const std::string& cache_dir = "");
+bool save_dispersal_artifacts(const dispersal_artifacts& artifacts);
+
+std::unique_ptr<replicate_step> replicate_stage_projection(const landscape_state& landscape,
+                                                           const transition_matrices& transitions, bool demo_stoch);
+std::unique_ptr<replicate_step> replicate_density_dependence(const landscape_state& landscape,
+                                                             const std::string& capacity_layer,
+                                                             const Rcpp::IntegerVector& stages);
+std::unique_ptr<replicate_step> replicate_demography_density_dependence(const landscape_state& landscape,
+                                                                         const std::string& capacity_layer,
+                                                                         double fecundity_fraction,
+                                                                         double survival_fraction, bool local);
+std::unique_ptr<replicate_step> replicate_dispersal(const landscape_state& landscape, const std::string& arrival_layer,
+                                                    const std::string& capacity_layer, Rcpp::NumericMatrix barriers_map,
+                                                    int barrier_type, bool use_barrier, int dispersal_steps,
+                                                    const Rcpp::IntegerVector& stages,
+                                                    const Rcpp::IntegerVector& dispersal_distance,
+                                                    const Rcpp::List& dispersal_kernel,
+                                                    const Rcpp::NumericVector& dispersal_proportion, int n_threads,
+                                                    bool skip_sampling, dispersal_artifacts* artifacts = NULL);
+
+#endif
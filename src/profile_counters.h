@@ -0,0 +1,65 @@
+#ifndef STEPS_PROFILE_COUNTERS_H
+#define STEPS_PROFILE_COUNTERS_H
+
+/*
+** Counts of the work done on the hot paths of the dispersal engines, for
+** profiling simulations (see rcpp_simulate).
+**
+** The counters are only compiled in when the package is built with
+** STEPS_PROFILE defined (e.g. PKG_CPPFLAGS = -DSTEPS_PROFILE in src/Makevars);
+** otherwise STEPS_COUNT() expands to nothing, and the counts read as zero.
+**
+** Each thread counts into its own (thread-local) counters, so counting needs
+** no synchronisation. Whoever runs a step takes the counts its thread made
+** with profile_take(); a parallel region gathers its workers' counts with
+** profile_take() into a shared profile_counts, and gives them to the calling
+** thread with profile_give() when it ends.
+*/
+
+enum profile_counter {
+  sinks_scanned,     // sinks tested for colonisation
+  sources_tested,    // candidate sources (populated, with capacity) within reach of a sink
+  random_draws,      // random variates drawn
+  barrier_rays,      // paths walked checking for barriers
+  colonisations,     // sinks colonised
+  n_profile_counters
+};
+
+static const char* const profile_counter_names[n_profile_counters] = {
+  "sinks_scanned", "sources_tested", "random_draws", "barrier_rays", "colonisations"
+};
+
+struct profile_counts {
+  unsigned long long count[n_profile_counters];
+  profile_counts(){ for (int c = 0; c < n_profile_counters; c++) count[c] = 0; }
+};
+
+#ifdef STEPS_PROFILE
+
+extern thread_local unsigned long long profile_thread_counts[n_profile_counters];
+
+#define STEPS_COUNT(counter, n) (profile_thread_counts[counter] += (n))
+
+/* move this thread's counts into totals (which other threads may also be adding to) */
+inline void profile_take(profile_counts& totals){
+  for (int c = 0; c < n_profile_counters; c++){
+    __atomic_fetch_add(&totals.count[c], profile_thread_counts[c], __ATOMIC_RELAXED);
+    profile_thread_counts[c] = 0;
+  }
+}
+
+/* add counts gathered from other threads to this thread's */
+inline void profile_give(const profile_counts& counts){
+  for (int c = 0; c < n_profile_counters; c++) profile_thread_counts[c] += counts.count[c];
+}
+
+#else
+
+#define STEPS_COUNT(counter, n) ((void) 0)
+
+inline void profile_take(profile_counts&){}
+inline void profile_give(const profile_counts&){}
+
+#endif
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef STEPS_RANDOM_STREAMS_H
+#define STEPS_RANDOM_STREAMS_H
+
+#include <Rcpp.h>
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+
+/*
+** Random number streams for the native engines.
+**
+** r_stream draws from R's own generator (so results follow set.seed), but can
+** only be used from the main thread.
+**
+** counter_stream is a counter-based generator (Philox4x32-10): the n-th draw
+** of a stream is a pure function of (seed, a, b, n), where a and b identify
+** the stream (e.g. dispersal step and cell). Streams need no shared state, so
+** any number of threads can draw from their own streams and the results do not
+** depend on how work is scheduled across threads.
+**
+** The samplers below are written against either stream type; r_stream
+** overloads defer to R's own samplers.
+*/
+
+struct r_stream {
+  double unif(){ return unif_rand(); }
+};
+
+class counter_stream {
+public:
+  counter_stream(uint64_t seed, uint32_t a, uint32_t b) : n_buffered(0) {
+    key[0] = (uint32_t) seed;
+    key[1] = (uint32_t) (seed >> 32);
+    counter[0] = 0;
+    counter[1] = 0;
+    counter[2] = a;
+    counter[3] = b;
+  }
+
+  /* uniform on the open interval (0, 1) */
+  double unif(){
+    if (n_buffered == 0) refill();
+    return buffer[--n_buffered];
+  }
+
+private:
+  uint32_t key[2];
+  uint32_t counter[4];
+  double buffer[2];
+  int n_buffered;
+
+  static void philox_round(uint32_t* ctr, const uint32_t* k){
+    uint64_t p0 = (uint64_t) 0xD2511F53 * ctr[0];
+    uint64_t p1 = (uint64_t) 0xCD9E8D57 * ctr[2];
+    uint32_t out0 = (uint32_t) (p1 >> 32) ^ ctr[1] ^ k[0];
+    uint32_t out1 = (uint32_t) p1;
+    uint32_t out2 = (uint32_t) (p0 >> 32) ^ ctr[3] ^ k[1];
+    uint32_t out3 = (uint32_t) p0;
+    ctr[0] = out0;
+    ctr[1] = out1;
+    ctr[2] = out2;
+    ctr[3] = out3;
+  }
+
+  void refill(){
+    uint32_t block[4] = {counter[0], counter[1], counter[2], counter[3]};
+    uint32_t k[2] = {key[0], key[1]};
+    for (int round = 0; round < 10; round++){
+      philox_round(block, k);
+      k[0] += 0x9E3779B9;
+      k[1] += 0xBB67AE85;
+    }
+    if (++counter[0] == 0) ++counter[1];
+
+    /* 53 random bits per double, offset by half a step so 0 is never returned */
+    uint64_t x0 = ((uint64_t) block[0] << 32 | block[1]) >> 11;
+    uint64_t x1 = ((uint64_t) block[2] << 32 | block[3]) >> 11;
+    buffer[0] = (x0 + 0.5) * (1.0 / 9007199254740992.0);
+    buffer[1] = (x1 + 0.5) * (1.0 / 9007199254740992.0);
+    n_buffered = 2;
+  }
+};
+
+/* Mix a seed with a stream identifier so that related streams (e.g. replicates) are unrelated. */
+inline uint64_t mix_seed(uint64_t seed, uint64_t id){
+  uint64_t z = seed + 0x9E3779B97F4A7C15ULL * (id + 1);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/*
+** Samplers.
+*/
+
+/* Like R::rbinom(1, p), no random number is used when the outcome is certain (or p is invalid). */
+template <class RNG>
+inline double rng_bernoulli(RNG& rng, double p){
+  if (!(p > 0) || p > 1) return 0.0;
+  if (p == 1) return 1.0;
+  return (rng.unif() < p) ? 1.0 : 0.0;
+}
+
+inline double rng_bernoulli(r_stream&, double p){
+  return R::rbinom(1, p);
+}
+
+template <class RNG>
+inline double rng_norm(RNG& rng){
+  /* Marsaglia's polar method (the second deviate is discarded to keep streams stateless) */
+  double u, v, s;
+  do {
+    u = 2.0 * rng.unif() - 1.0;
+    v = 2.0 * rng.unif() - 1.0;
+    s = u * u + v * v;
+  } while (s >= 1.0 || s == 0.0);
+  return u * sqrt(-2.0 * log(s) / s);
+}
+
+inline double rng_norm(r_stream&){
+  return norm_rand();
+}
+
+/* Exponential(1), by inversion */
+template <class RNG>
+inline double rng_exp(RNG& rng){
+  return -log(rng.unif());
+}
+
+inline double rng_exp(r_stream&){
+  return exp_rand();
+}
+
+/* Gamma(shape, 1) for shape >= 1, Marsaglia & Tsang (2000). */
+template <class RNG>
+inline double rng_gamma(RNG& rng, double shape){
+  double d = shape - 1.0 / 3.0;
+  double c = 1.0 / sqrt(9.0 * d);
+  double x, v, u;
+  for (;;){
+    do {
+      x = rng_norm(rng);
+      v = 1.0 + c * x;
+    } while (v <= 0.0);
+    v = v * v * v;
+    u = rng.unif();
+    if (u < 1.0 - 0.0331 * x * x * x * x) return d * v;
+    if (log(u) < 0.5 * x * x + d * (1.0 - v + log(v))) return d * v;
+  }
+}
+
+/* Binomial by inversion (BINV), for p <= 0.5 and a small mean. */
+template <class RNG>
+inline double rng_binom_inversion(RNG& rng, double n, double p){
+  double q = 1.0 - p;
+  double s = p / q;
+  double a = (n + 1.0) * s;
+  double r = pow(q, n);
+  double u = rng.unif();
+  double x = 0.0;
+  while (u > r && x < n){
+    u -= r;
+    x += 1.0;
+    r *= (a / x - s);
+  }
+  return x;
+}
+
+/*
+** Binomial(n, p). Large means are reduced with Knuth's beta order statistic
+** splitting (exact, O(log n) steps) before finishing by inversion.
+*/
+template <class RNG>
+inline double rng_binom(RNG& rng, double n, double p){
+  if (!(n > 0) || !(p > 0)) return 0.0;
+  n = floor(n + 0.5);
+  if (p >= 1.0) return n;
+
+  /* the result is count + sign * Binomial(n, p) for the current n and p */
+  double count = 0.0;
+  double sign = 1.0;
+  double a, beta;
+  while (n > 0){
+    /* work with p <= 0.5, counting failures instead of successes if needed */
+    if (p > 0.5){
+      count += sign * n;
+      sign = -sign;
+      p = 1.0 - p;
+    }
+    if (n * p < 30.0){
+      count += sign * rng_binom_inversion(rng, n, p);
+      break;
+    }
+    /* the a-th smallest of n uniforms is Beta(a, n + 1 - a) distributed */
+    a = 1.0 + floor(n / 2.0);
+    beta = rng_gamma(rng, a);
+    beta = beta / (beta + rng_gamma(rng, n + 1.0 - a));
+    if (beta >= p){
+      n = a - 1.0;
+      p = p / beta;
+    } else {
+      count += sign * a;
+      n = n - a;
+      p = (p - beta) / (1.0 - beta);
+    }
+  }
+  return count;
+}
+
+inline double rng_binom(r_stream&, double n, double p){
+  return R::rbinom(n, p);
+}
+
+/* Poisson by inversion, for a small mean. */
+template <class RNG>
+inline double rng_pois_inversion(RNG& rng, double mu){
+  double r = exp(-mu);
+  double u = rng.unif();
+  double x = 0.0;
+  while (u > r && r > 0){
+    u -= r;
+    x += 1.0;
+    r *= mu / x;
+  }
+  return x;
+}
+
+/*
+** Poisson(mu). Large means are reduced with Ahrens and Dieter's gamma
+** splitting (exact: the m-th event of a unit-rate Poisson process arrives at a
+** Gamma(m) time) before finishing by inversion.
+*/
+template <class RNG>
+inline double rng_pois(RNG& rng, double mu){
+  if (!(mu > 0)) return 0.0;
+  double count = 0.0;
+  while (mu >= 30.0){
+    double m = floor(0.875 * mu);
+    double arrival = rng_gamma(rng, m);
+    /* if the m-th event is after mu, the first m - 1 are uniform on (0, arrival) */
+    if (arrival > mu) return count + rng_binom(rng, m - 1.0, mu / arrival);
+    count += m;
+    mu -= arrival;
+  }
+  return count + rng_pois_inversion(rng, mu);
+}
+
+inline double rng_pois(r_stream&, double mu){
+  return R::rpois(mu);
+}
+
+/*
+** Multinomial(size, prob) by sequential binomial draws, as in R's rmultinom
+** (so with r_stream the draws match stats::rmultinom(1, size, prob)). prob
+** need not sum to one; out receives the n counts.
+*/
+template <class RNG>
+inline void rng_multinom(RNG& rng, double size, const double* prob, int n, double* out){
+  double p_sum = 0.0, pp;
+  long double p_total = 0.0;
+  int k;
+  for (k = 0; k < n; k++){
+    out[k] = 0.0;
+    p_sum += prob[k];
+  }
+  if (!(p_sum > 0) || !(size > 0)) return;
+  for (k = 0; k < n; k++) p_total += prob[k] / p_sum;
+  for (k = 0; k < n - 1; k++){
+    if (prob[k] > 0){
+      pp = (double) ((prob[k] / p_sum) / p_total);
+      out[k] = (pp < 1.0) ? rng_binom(rng, size, pp) : size;
+      size -= out[k];
+    }
+    if (size <= 0) return;
+    p_total -= prob[k] / p_sum;
+  }
+  out[n - 1] = size;
+}
+
+/*
+** Normal(mean, sd) truncated to [lower, upper]. When the interval holds a fair
+** share of the normal's mass, normal deviates are drawn until one falls in it;
+** otherwise the truncated distribution is inverted, through the log of its
+** tail probabilities so that intervals far out in a tail keep their precision.
+** A zero sd gives the mean, moved into the interval.
+*/
+template <class RNG>
+inline double rng_truncnorm(RNG& rng, double mean, double sd, double lower, double upper){
+  if (ISNAN(mean) || ISNAN(sd) || ISNAN(lower) || ISNAN(upper) || sd < 0 || lower > upper) return NA_REAL;
+  if (sd == 0 || lower == upper) return std::min(std::max(mean, lower), upper);
+
+  double alpha = (lower - mean) / sd, beta = (upper - mean) / sd, z;
+  if (R::pnorm(beta, 0.0, 1.0, 1, 0) - R::pnorm(alpha, 0.0, 1.0, 1, 0) > 0.25){
+    do {
+      z = rng_norm(rng);
+    } while (z < alpha || z > beta);
+  } else {
+    /* invert in the tail the interval lies in (flipped to the upper tail) */
+    bool flip = beta <= 0;
+    double a = flip ? -beta : alpha, b = flip ? -alpha : beta;
+    double log_a = R::pnorm(a, 0.0, 1.0, 0, 1), log_b = R::pnorm(b, 0.0, 1.0, 0, 1);
+    double u = rng.unif();
+    /* log(P(Z > b) + u (P(Z > a) - P(Z > b))) */
+    double log_p = log_a + std::log(u + (1.0 - u) * std::exp(log_b - log_a));
+    z = R::qnorm(log_p, 0.0, 1.0, 0, 1);
+    z = std::min(std::max(z, a), b);
+    if (flip) z = -z;
+  }
+  return mean + sd * z;
+}
+
+#endif
@@ -1,4 +1,13 @@
 #include <Rcpp.h>
+#include "dispersal_stencil.h"
+#include "random_streams.h"
+#include "barrier_paths.h"
+#include "landscape_state.h"
+#include "profile_counters.h"
+#include <memory>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 using namespace Rcpp;
 
 
@@ -10,192 +19,203 @@ using namespace Rcpp;
 
 // [[Rcpp::export]]
 bool barrier_to_dispersal(int sink_x, int sink_y, int source_x, int source_y, NumericMatrix barriers_map, int barrier_type){
-  int  dist_x, dist_y, i, pixel_x, pixel_y, distance_max, barrier_counter;
-  bool barrier_found;
-  barrier_found = false;
-
-  /*
-  ** Calculate the distance in both dimensions between the source and sink
-  ** pixels and take the largest of the two.
-  */
-  dist_x = source_x - sink_x;
-  dist_y = source_y - sink_y;
-  if (abs (dist_x) >= abs (dist_y)){
-    distance_max = abs(dist_x);
-  } else {
-    distance_max = abs(dist_y);
-  }
+  int nrows = barriers_map.nrow();
+  int distance_max = std::max(std::abs(source_x - sink_x), std::abs(source_y - sink_y));
+  std::vector<int> pixels;
+  r_stream rng;
+  barrier_path_pixels(source_x - sink_x, source_y - sink_y, barrier_type, nrows, pixels);
+  return paths_blocked(rng, barriers_map.begin(), sink_x + sink_y * nrows, pixels.data(), distance_max, barrier_type);
+}
+
+/*
+** walk_dispersal_stencil: Search for a potential source cell around sink pixel
+**            (i, j) by walking the precomputed dispersal stencil. Offsets within
+**            the dispersal distance and their kernel values are already known,
+**            so only the per-pixel conditions are tested here. When the whole
+**            stencil fits inside the matrix (interior = true) the bounds checks
+**            are skipped and sources are addressed by their linear offset.
+*/
+template <bool interior, class RNG>
+static void walk_dispersal_stencil(RNG& rng, int i, int j, const dispersal_stencil& stencil,
+                                   NumericMatrix& carrying_capacity_available,
+                                   NumericMatrix& tracking_population_state,
+                                   NumericMatrix& habitat_suitability_map, barrier_paths* barriers,
+                                   int loopID, int* source_found){
+
+  int ncols = carrying_capacity_available.ncol();
+  int nrows = carrying_capacity_available.nrow();
+  const double* capacity = carrying_capacity_available.begin();
+  const double* tracking = tracking_population_state.begin();
+  const double* suitability = habitat_suitability_map.begin();
+  int sink = i + j * nrows;
+  int n, k, l, source, n_offsets = stencil.size();
+  double prob_colonisation, rnd;
+  bool cost_distance = barriers && barriers->cost_distance();
+  const uint16_t* rings = NULL;
+  bool rings_found = false;
+
+  for (n = 0; n < n_offsets; n++){
+    k = i + stencil.dx[n];
+    l = j + stencil.dy[n];
 
-  /*
-  ** Check the possible paths from source to sink and see if there is a path
-  ** without barriers.
-  */
-  if (barrier_type == 0){
-    /*
-    ** Weak barrier: If there is at least one free path we're good.
-    **
-    ** BARRIER MIDDLE
-    */
-    barrier_found = false;
-    for (i = 1; i <= distance_max; i++){
-      pixel_x = round(sink_x + (1.0 * i / distance_max * dist_x));
-      pixel_y = round(sink_y + (1.0 * i / distance_max * dist_y));
-      if (R::rbinom(1, barriers_map(pixel_x,pixel_y)) == 1) {
-		  barrier_found = true;
-		  break;
-      }
-    }
-    if (!barrier_found){
-      return(barrier_found);
-    }
-    /*
-    ** BARRIER TOP_LEFT
-    */
-    barrier_found = false;
-    for (i = 1; i <= distance_max; i++){
-      pixel_x = round(sink_x - 0.49 + (1.0 * i / distance_max * dist_x));
-      pixel_y = round(sink_y - 0.49 + (1.0 * i / distance_max * dist_y));
-      if (R::rbinom(1, barriers_map(pixel_x,pixel_y)) == 1){
-		barrier_found = true;
-		break;
-      }
-    }
-    if (!barrier_found){
-      return(barrier_found);
-    }
     /*
-    ** BARRIER TOP_RIGHT
+    ** 1. The pixel must be within the limits of the matrix's extent (always
+    **    true for interior sinks).
     */
-    barrier_found = false;
-    for (i = 1; i <= distance_max; i++){
-      pixel_x = round(sink_x + 0.49 + (1.0 * i / distance_max * dist_x));
-      pixel_y = round(sink_y - 0.49 + (1.0 * i / distance_max * dist_y));
-      if (R::rbinom(1, barriers_map(pixel_x,pixel_y)) == 1){
-	barrier_found = true;
-	break;
-      }
-    }
-    if (!barrier_found)
-    {
-     return(barrier_found);
+    if (!interior){
+      if ((k < 0) || (k >= nrows) || (l < 0) || (l >= ncols)) continue;
     }
+    source = sink + stencil.offset[n];
+
     /*
-    ** Barrier DOWN_LEFT
+    ** 2. The pixel must be colonized, but not during the current loop, and is
+    **    not NA. It must have avaliable carrying capacity to allow recruitment.
     */
-    barrier_found = false;
-    for (i = 1; i <= distance_max; i++){
-      pixel_x = round(sink_x - 0.49 + (1.0 * i / distance_max * dist_x));
-      pixel_y = round(sink_y + 0.49 + (1.0 * i / distance_max * dist_y));
-      if (R::rbinom(1, barriers_map(pixel_x,pixel_y)) == 1){
-	barrier_found = true;
-	break;
+    if (capacity[source] > 0 && tracking[source] != loopID && !R_IsNA(tracking[source])){
+      STEPS_COUNT(sources_tested, 1);
+      STEPS_COUNT(random_draws, 1);
+
+      /*
+      ** 3. Compute the probability of colonisation of the sink pixel from the
+      **    precomputed kernel value for this offset - or, with cost-distance
+      **    barriers around the sink, the kernel value at the effective
+      **    distance of the source (found once for the sink).
+      */
+      prob_colonisation = stencil.weight[n] * suitability[source];
+      if (cost_distance){
+        if (!rings_found){
+          rings = barriers->effective_rings(sink);
+          rings_found = true;
+        }
+        if (rings) prob_colonisation = stencil.ring_weight(rings[n]) * suitability[source];
       }
-    }
-    if (!barrier_found){
-     return(barrier_found);
-    }
-    /*
-    ** Barrier DOWN_RIGHT
-    */
-    barrier_found = false;
-    for (i = 1; i <= distance_max; i++){
-      pixel_x = round(sink_x + 0.49 + (1.0 * i / distance_max * dist_x));
-      pixel_y = round(sink_y + 0.49 + (1.0 * i / distance_max * dist_y));
-      if (R::rbinom(1, barriers_map(pixel_x,pixel_y)) == 1){
-	barrier_found = true;
-	break;
+      rnd = rng.unif();
+      if (rnd < prob_colonisation || prob_colonisation == 1.0){
+        /*
+        ** The last thing we need to check for is whether there is a "barrier"
+        ** obstacle between the source and sink pixel. We check this last as it
+        ** requires significant computing time (cost-distance barriers have
+        ** already been accounted for).
+        */
+        if (!barriers || cost_distance || !barriers->blocked(rng, sink, n)){
+          source_found[0] = k;
+          source_found[1] = l;
+        }
       }
     }
-    if (!barrier_found){
-     return(barrier_found);
-         }
   }
-  else if (barrier_type == 1){
-    /*
-    ** Strong barrier: If more than one way is blocked by a barrier then
-    **                 colonization fails.
-    */
-    barrier_counter = 0;
-    barrier_found = false;
-    /*
-    ** BARRIER MIDDLE
-    */
-    for (i = 1; i <= distance_max; i++){
-      pixel_x = round(sink_x + (1.0 * i / distance_max * dist_x));
-      pixel_y = round(sink_y + (1.0 * i / distance_max * dist_y));
-      if (R::rbinom(1, barriers_map(pixel_x,pixel_y)) == 1){
-	barrier_counter++;
-	break;
-      }
-    }
-    /*
-    ** BARRIER TOP_LEFT
-    */
-    for (i = 1; i <= distance_max; i++){
-	  pixel_x = round(sink_x - 0.49 + (((i-1.0) / distance_max * dist_x) +
-					((1.0 / distance_max * dist_x) / 2.0)));
-      pixel_y = round(sink_y - 0.49 + (((i-1.0) / distance_max * dist_y) +
-					((1.0 / distance_max * dist_y) / 2.0)));
-      if (R::rbinom(1, barriers_map(pixel_x,pixel_y)) == 1){
-	barrier_counter++;
-	break;
-      }
-    }
-    if (barrier_counter > 1){
-      barrier_found = true;
-      return(barrier_found);
+}
+
+/*
+** skip_dispersal_stencil: Sample the source of sink pixel (i, j) as
+**            walk_dispersal_stencil does - the last candidate in stencil order
+**            to pass its colonisation draw and barrier check - with far fewer
+**            random draws. Candidates are walked in reverse, stopping at the
+**            first that passes. Instead of a uniform draw for each, an
+**            exponential clock is drawn and run down by each candidate's kernel
+**            hazard, -log(1 - weight), so a candidate is proposed with
+**            probability weight; proposals are then accepted with the source's
+**            habitat suitability and checked for barriers, and the clock is
+**            drawn again after a rejection. A source whose suitability is above
+**            1 passes with probability min(1, weight * suitability), as in the
+**            walk, which thinning can't give, so it is tested with a draw of its
+**            own, leaving the (memoryless) clock as it was. The source is chosen
+**            with the same probabilities, but not by the same random draws.
+*/
+template <bool interior, class RNG>
+static void skip_dispersal_stencil(RNG& rng, int i, int j, const dispersal_stencil& stencil,
+                                   NumericMatrix& carrying_capacity_available,
+                                   NumericMatrix& tracking_population_state,
+                                   NumericMatrix& habitat_suitability_map, barrier_paths* barriers,
+                                   int loopID, int* source_found){
+
+  int ncols = carrying_capacity_available.ncol();
+  int nrows = carrying_capacity_available.nrow();
+  const double* capacity = carrying_capacity_available.begin();
+  const double* tracking = tracking_population_state.begin();
+  const double* suitability = habitat_suitability_map.begin();
+  int sink = i + j * nrows;
+  int n, k, l, source;
+  double clock = -1, hazard, prob_colonisation;
+  bool cost_distance = barriers && barriers->cost_distance();
+  const uint16_t* rings = NULL;
+  bool rings_found = false;
+
+  for (n = stencil.size() - 1; n >= 0; n--){
+    k = i + stencil.dx[n];
+    l = j + stencil.dy[n];
+    if (!interior){
+      if ((k < 0) || (k >= nrows) || (l < 0) || (l >= ncols)) continue;
     }
-    /*
-    ** BARRIER TOP_RIGHT
-    */
-    for (i = 1; i <= distance_max; i++){
-      pixel_x = round(sink_x + 0.49 + (((i-1.0) / distance_max * dist_x) +
-					((1.0 / distance_max * dist_x) / 2.0)));
-      pixel_y = round(sink_y - 0.49 + (((i-1.0) / distance_max * dist_y) +
-					((1.0 / distance_max * dist_y) / 2.0)));
-      if (R::rbinom(1, barriers_map(pixel_x,pixel_y)) == 1){
-	barrier_counter++;
-	break;
+    source = sink + stencil.offset[n];
+    if (!(capacity[source] > 0 && tracking[source] != loopID && !R_IsNA(tracking[source]))) continue;
+    STEPS_COUNT(sources_tested, 1);
+
+    hazard = stencil.hazard[n];
+    if (cost_distance){
+      if (!rings_found){
+        rings = barriers->effective_rings(sink);
+        rings_found = true;
       }
+      if (rings) hazard = stencil.ring_hazard(rings[n]);
     }
-    if (barrier_counter > 1){
-      barrier_found = true;
-     return(barrier_found);
-    }
-    /*
-    ** BARRIER DOWN_LEFT
-    */
-    for (i = 1; i <= distance_max; i++){
-      pixel_x = round (sink_x - 0.49 + (((i-1.0) / distance_max * dist_x) +
-					((1.0 / distance_max * dist_x) / 2.0)));
-      pixel_y = round (sink_y + 0.49 + (((i-1.0) / distance_max * dist_y) +
-					((1.0 / distance_max * dist_y) / 2.0)));
-      if (R::rbinom(1, barriers_map(pixel_x,pixel_y)) == 1){
-		barrier_counter++;
-		break;
+    if (hazard == 0) continue;
+
+    if (suitability[source] > 1.0){
+      STEPS_COUNT(random_draws, 1);
+      prob_colonisation = (rings ? stencil.ring_weight(rings[n]) : stencil.weight[n]) * suitability[source];
+      if (rng.unif() < prob_colonisation || prob_colonisation >= 1.0){
+        if (!barriers || cost_distance || !barriers->blocked(rng, sink, n)){
+          source_found[0] = k;
+          source_found[1] = l;
+          return;
+        }
       }
+      continue;
     }
-    if (barrier_counter > 1){
-      barrier_found = true;
-     return(barrier_found);
+
+    if (clock < 0){
+      STEPS_COUNT(random_draws, 1);
+      clock = rng_exp(rng);
     }
-    /*
-    ** BARRIER DOWN_RIGHT
-    */
-    for (i = 1; i <= distance_max; i++){
-      pixel_x = round (sink_x + 0.49 + (((i-1.0) / distance_max * dist_x) +
-					((1.0 / distance_max * dist_x) / 2.0)));
-      pixel_y = round (sink_y + 0.49 + (((i-1.0) / distance_max * dist_y) +
-					((1.0 / distance_max * dist_y) / 2.0)));
-      if (R::rbinom(1, barriers_map(pixel_x,pixel_y)) == 1){
-	barrier_counter++;
-	break;
+    clock -= hazard;
+    if (clock > 0) continue;
+
+    /* proposed: accept with the suitability, then check for barriers */
+    STEPS_COUNT(random_draws, 1);
+    clock = -1;
+    if (rng.unif() < suitability[source] || suitability[source] == 1.0){
+      if (!barriers || cost_distance || !barriers->blocked(rng, sink, n)){
+        source_found[0] = k;
+        source_found[1] = l;
+        return;
       }
     }
-    if (barrier_counter > 1){
-      barrier_found = true;
-      return(barrier_found);
+  }
+}
+
+template <class RNG>
+static void search_source_cell(RNG& rng, int i, int j, const dispersal_stencil& stencil,
+                               NumericMatrix& carrying_capacity_available,
+                               NumericMatrix& tracking_population_state,
+                               NumericMatrix& habitat_suitability_map, barrier_paths* barriers,
+                               int loopID, int* source_found){
+  source_found[0] = -9999;
+  source_found[1] = -9999;
+  if (stencil.skip){
+    if (stencil.is_interior(i, j, carrying_capacity_available.ncol())){
+      skip_dispersal_stencil<true>(rng, i, j, stencil, carrying_capacity_available, tracking_population_state,
+                                   habitat_suitability_map, barriers, loopID, source_found);
+    } else {
+      skip_dispersal_stencil<false>(rng, i, j, stencil, carrying_capacity_available, tracking_population_state,
+                                    habitat_suitability_map, barriers, loopID, source_found);
     }
+  } else if (stencil.is_interior(i, j, carrying_capacity_available.ncol())){
+    walk_dispersal_stencil<true>(rng, i, j, stencil, carrying_capacity_available, tracking_population_state,
+                                 habitat_suitability_map, barriers, loopID, source_found);
+  } else {
+    walk_dispersal_stencil<false>(rng, i, j, stencil, carrying_capacity_available, tracking_population_state,
+                                  habitat_suitability_map, barriers, loopID, source_found);
   }
 }
 
@@ -203,72 +223,18 @@ bool barrier_to_dispersal(int sink_x, int sink_y, int source_x, int source_y, Nu
 IntegerVector can_source_cell_disperse(int i, int j, NumericMatrix carrying_capacity_available, 
                                        NumericMatrix tracking_population_state, NumericMatrix habitat_suitability_map,
                                        NumericMatrix barriers_map, bool use_barrier, int barrier_type, int loopID, 
-                                       int dispersal_distance, NumericVector dispersal_kernel){
-
- 	int ncols = carrying_capacity_available.ncol();
-  int nrows = carrying_capacity_available.nrow();
-	int    k, l, real_distance;
-	double prob_colonisation, rnd;
-	IntegerVector source_found(2,-9999);
+                                       int dispersal_distance, NumericVector dispersal_kernel,
+                                       bool skip_sampling = false){
 
-  /*
-  ** Search for a potential source cell. i and j are the coordinates of the
-  ** sink cell. k and l are the coordinates of the potential source cell.
-  */
-  for (k = i - dispersal_distance; k <= i + dispersal_distance; k++){
-    for (l = j - dispersal_distance; l <= j + dispersal_distance; l++){
-
-      /*
-      ** 1. Test of basic conditions to see if a pixel could be a potential
-      **    source cell:
-      **    - The pixel must be within the limits of the matrix's extent.
-      **    - The pixel must be colonized, but not during the current loop, and is not NA.
-      ** 	  - The pixel must have avaliable carrying capacity to allow recruitment.
-      */
-      if ((k >= 0) && (k < nrows) && (l >= 0) && (l < ncols)){
-		    if (carrying_capacity_available(k,l) > 0){
-		        if (tracking_population_state(k,l) != loopID){
-		            if(!R_IsNA(tracking_population_state(k,l))){
-          	    /*
-          	    ** 2. Compute the distance between sink and (potential) source pixel
-          	    **    and check if it is <= maximum dispersal distance. The distance
-          	    **    is computed in pixel units.
-          	    */
-          	    real_distance = round(sqrt((k-i)*(k-i) + (l-j)*(l-j)));
-	              if ((real_distance > 0) && (real_distance <= dispersal_distance)){
-        	      /*
-        	      ** 3. Compute the probability of colonisation of the sink pixel.
-        	      **    This probability depends on several factors:
-        	      **    - Disance between source and sink cells.
-        	      */
-          		  prob_colonisation = dispersal_kernel[real_distance-1] * (habitat_suitability_map(k,l));
-        	      rnd = as<double>(Rcpp::runif(1));
-	              if (rnd < prob_colonisation || prob_colonisation == 1.0){
-              				/*
-              				** When we reach this stage, the last thing we need to check for
-              				** is whether there is a "barrier" obstacle between the source
-              				** and sink pixel. We check this last as it requires significant
-              				** computing time.
-              				*/
-              				if (use_barrier){
-              				  if (!barrier_to_dispersal(i, j, k, l, barriers_map, barrier_type)){
-              					source_found[0] = k;
-              					source_found[1] = l;
-              				  }
-              				}
-              				else {
-              				source_found[0] = k;
-              				source_found[1] = l;
-          					}
-	                }
-	              }
-		          }
-		        }
-					}
-  			}
-      }
-		}
-  return(source_found);
+  int source_found[2];
+  r_stream rng;
+  dispersal_stencil stencil = build_dispersal_stencil(dispersal_distance, dispersal_kernel,
+                                                      carrying_capacity_available.nrow(), skip_sampling);
+  std::unique_ptr<barrier_paths> barriers;
+  if (use_barrier) barriers.reset(new barrier_paths(stencil, barriers_map, barrier_type));
+  search_source_cell(rng, i, j, stencil, carrying_capacity_available, tracking_population_state,
+                     habitat_suitability_map, barriers.get(), loopID, source_found);
+  return(IntegerVector::create(source_found[0], source_found[1]));
 }
 
 // This function cleans up the habitat matrix before dispersal.
@@ -310,15 +276,16 @@ NumericMatrix clean_matrix(NumericMatrix in_matrix,
      return(in_matrix);
 }
 
-// [[Rcpp::export]]
-int proportion_of_population_to_disperse(int source_x, int source_y, int sink_x, int sink_y, 
-                                         NumericMatrix starting_population_state,
-                                         NumericMatrix current_carrying_capacity, 
-                                         double dispersal_proportion){
+template <class RNG>
+static int population_to_disperse(RNG& rng, int source_x, int source_y, int sink_x, int sink_y,
+                                  NumericMatrix& starting_population_state,
+                                  NumericMatrix& current_carrying_capacity,
+                                  double dispersal_proportion){
   	        double source_pop, source_pop_dispersed;
             source_pop = round(starting_population_state(source_x,source_y));
             if(source_pop<1)source_pop=0;
-            source_pop_dispersed = R::rbinom(source_pop,dispersal_proportion);
+            source_pop_dispersed = rng_binom(rng, source_pop, dispersal_proportion);
+            STEPS_COUNT(random_draws, 1);
             // Rcpp::Rcout << source_pop_dispersed << ' ' << source_pop << std::endl;
             if (current_carrying_capacity(sink_x,sink_y) < source_pop_dispersed){
                 // could include this function to allow a smaller proportion of the population to disperse.
@@ -330,6 +297,16 @@ int proportion_of_population_to_disperse(int source_x, int source_y, int sink_x,
   return(source_pop_dispersed);
 }
 
+// [[Rcpp::export]]
+int proportion_of_population_to_disperse(int source_x, int source_y, int sink_x, int sink_y, 
+                                         NumericMatrix starting_population_state,
+                                         NumericMatrix current_carrying_capacity, 
+                                         double dispersal_proportion){
+  r_stream rng;
+  return population_to_disperse(rng, source_x, source_y, sink_x, sink_y, starting_population_state,
+                                current_carrying_capacity, dispersal_proportion);
+}
+
 // [[Rcpp::export]]
 NumericMatrix na_matrix(int nr, int nc){
   NumericMatrix m(nr,nc) ;
@@ -337,52 +314,122 @@ NumericMatrix na_matrix(int nr, int nc){
   return m ;
 }
 
-// //' dispersal function for dynamic metapopulation models
-// //' @param current_distribution raster of current population distribution.
-// //' @param habitat_suitability raster of habitat suitability that has been converted to carrying capacity
-// //' @param barrier_map raster of barriers to the dispersal, 1=barrier; 0=no barrier.
-// //' @param barrier_type if 0 weak barrier, if 1 strong barriers.
-// //' @param use_barrier if true use barriers in dispersal analysis.
-// //' @param dispersal_steps The number of dispersal iterations per C++ call.
-// //' @param dispersal_distance The maximum number of cells the species can disperse.
-// //' @param dispersal_kernal a numeric vector of probabilites of dispersing from one to n cells, where n is the dispersal distance.
-// //' @param dispersal_proportion the proportion of species that will disperse from source cell, needs to be between 0 and 1. e.g 0.2 means that 20% of the cell's population disperses. 
-// [[Rcpp::export]]
-List rcpp_dispersal(NumericMatrix starting_population_state, NumericMatrix potential_carrying_capacity,
-  NumericMatrix habitat_suitability_map,NumericMatrix barriers_map, int barrier_type, bool use_barrier, int dispersal_steps,
-  int dispersal_distance, NumericVector dispersal_kernel, double dispersal_proportion){
+/*
+** disperse_to_sink: Try to colonise sink pixel (i, j) from a source within the
+**            dispersal distance. Returns the linear index of the source pixel
+**            individuals dispersed from, or -1 if the sink was not colonised.
+*/
+template <class RNG>
+static int disperse_to_sink(RNG& rng, int i, int j, const dispersal_stencil& stencil,
+                            NumericMatrix& starting_population_state,
+                            NumericMatrix& carrying_capacity_available_cleaned,
+                            NumericMatrix& tracking_population_state_cleaned,
+                            NumericMatrix& future_population_state,
+                            NumericMatrix& habitat_suitability_map, barrier_paths* barriers,
+                            int loopID, double dispersal_proportion){
+
+  int cell_in_dispersal_distance[2];
+  STEPS_COUNT(sinks_scanned, 1);
+
+  /* 1. Test whether the pixel is a suitable sink (i.e., its habitat
+  **    is suitable, it has avaliable carrying capacity, it's not NA and is not on a barrier). */
+  if(!((habitat_suitability_map(i,j) > 0) && (carrying_capacity_available_cleaned(i,j) > 0) &&
+     !R_IsNA(carrying_capacity_available_cleaned(i,j)))) return -1;
+
+  /* 2. Test whether there is a source cell within the dispersal
+  **    distance. To be more time efficient, this code runs only if
+  **    the answer to the first question is positive. This is a bit slower,
+  **	  especially if you include barriers in dispersal step.
+  **/
+  search_source_cell(rng, i, j, stencil, starting_population_state, tracking_population_state_cleaned,
+                     habitat_suitability_map, barriers, loopID, cell_in_dispersal_distance);
+  if(cell_in_dispersal_distance[0] < 0 || cell_in_dispersal_distance[1] < 0) return -1;
+
+  /* Only if the 2 conditions are fullfilled the cell's is there dispersal to this cell and the population size is changed. */
+  int source_x = cell_in_dispersal_distance[0];
+  int source_y = cell_in_dispersal_distance[1];
+  int source_pop_dispersed = population_to_disperse(rng, source_x, source_y, i, j, starting_population_state,
+                                                    carrying_capacity_available_cleaned, dispersal_proportion);
+  future_population_state(i,j) = starting_population_state(i,j) + source_pop_dispersed;
+  starting_population_state(source_x,source_y) = starting_population_state(source_x,source_y) - source_pop_dispersed;
+  if(starting_population_state(source_x,source_y)<0)starting_population_state(source_x,source_y)=0;
+  tracking_population_state_cleaned(i,j) = loopID;
+  STEPS_COUNT(colonisations, 1);
+  return source_x + source_y * starting_population_state.nrow();
+}
+
+/*
+** prepare_dispersal_state: check how much carrying capacity is free per-cell (this will
+**            enable dispersal to these cells if needed) and set up the tracking state,
+**            both filtered for barriers and NoData. The outputs must already have the
+**            dimensions of the population, and every cell is overwritten.
+**
+** This is the single-pass equivalent of filling both matrices with NoData, setting
+** carrying capacity available = potential carrying capacity - current population state
+** and tracking = current population state wherever the population is not NoData, then
+** filtering them with clean_matrix:
+**  1. replace any value < 0 by 0 (this removes NoData).
+**  2. set values to 0 where barrier = 1.
+*/
+static void prepare_dispersal_state(NumericMatrix& starting_population_state, NumericMatrix& potential_carrying_capacity,
+                                    NumericMatrix& barriers_map, NumericMatrix& carrying_capacity_available_cleaned,
+                                    NumericMatrix& tracking_population_state_cleaned){
+  const double* starting = starting_population_state.begin();
+  const double* capacity = potential_carrying_capacity.begin();
+  const double* barriers = barriers_map.begin();
+  double* available = carrying_capacity_available_cleaned.begin();
+  double* tracking = tracking_population_state_cleaned.begin();
+  int cell, n_cells = starting_population_state.size();
+
+  for(cell = 0; cell < n_cells; cell++){
+    available[cell] = NA_REAL;
+    tracking[cell] = NA_REAL;
+    if(!R_IsNA(starting[cell])){
+      available[cell] = capacity[cell] - starting[cell];
+      tracking[cell] = starting[cell];
+    }
+    if(available[cell] < 0) available[cell] = 0;
+    if(tracking[cell] < 0) tracking[cell] = 0;
+    if(barriers[cell] == 1){
+      available[cell] = 0;
+      tracking[cell] = 0;
+    }
+  }
+}
 
+/* Cells that were not colonised keep their (post-dispersal) starting population. */
+static void fill_undispersed_cells(NumericMatrix& future_population_state, NumericMatrix& starting_population_state){
+  double* future = future_population_state.begin();
+  const double* starting = starting_population_state.begin();
+  int cell, n_cells = future_population_state.size();
+  for(cell = 0; cell < n_cells; cell++){
+    if(R_IsNA(future[cell])){
+      future[cell] = starting[cell];
+      if(future[cell] < 0) future[cell] = 0;
+    }
+  }
+}
+
+/*
+** disperse_serial: run the dispersal steps, visiting sinks in row-major order and drawing
+**            random numbers from R's generator. future_population_state must be filled with
+**            NoData on entry. The frontier is (re)built here if use_frontier is true.
+*/
+static void disperse_serial(const dispersal_stencil& stencil, NumericMatrix& starting_population_state,
+                            NumericMatrix& carrying_capacity_available_cleaned,
+                            NumericMatrix& tracking_population_state_cleaned,
+                            NumericMatrix& future_population_state,
+                            NumericMatrix& habitat_suitability_map, barrier_paths* barriers,
+                            int dispersal_steps, double dispersal_proportion,
+                            bool use_frontier, dispersal_frontier& frontier){
 	  int ncols = starting_population_state.ncol();
     int nrows = starting_population_state.nrow();
-    NumericMatrix carrying_capacity_available = na_matrix(nrows,ncols); // carrying capacity avaliable.
-    NumericMatrix tracking_population_state = na_matrix(nrows,ncols); // tracking population state.
-    NumericMatrix future_population_state = na_matrix(nrows,ncols); // future population size (after dispersal).
-    int loopID, dispersal_step, i, j;
-    bool habitat_is_suitable;//, cell_in_dispersal_distance;
-
-	// check how much carrying capacity is free per-cell - this will enable dispersal to these cells if needed.
-     for(i = 0; i < nrows; i++){
-         for(j = 0; j < ncols; j++){
-      			 if(!R_IsNA(starting_population_state(i,j))){
-	              carrying_capacity_available(i,j) = potential_carrying_capacity(i,j) - starting_population_state(i,j); // carrying capacity available = potential carrying capacity - current population state.
-                tracking_population_state(i,j) = starting_population_state(i,j);			   
-	          }
-	      }
-     }
-
-      /* Filter the habitat suitability matrix in three ways:
-      **  1. replace any value < 0 by 0 (this removes NoData).
-      **  2. set habitat suitability to 0 where barrier = 1.
-      **  3. set habitat suitability values to NoData where barrier = NoData.
-      ** and also  */
-      // if(use_barrier){ 
-      NumericMatrix carrying_capacity_available_cleaned = clean_matrix(carrying_capacity_available, barriers_map, true, true, true);
-      // }
-      // else {
-        // NumericMatrix carrying_capacity_available_cleaned = clean_matrix(carrying_capacity_available, barriers_map, true, false, false);
-      // }
-      NumericMatrix tracking_population_state_cleaned = clean_matrix(tracking_population_state, barriers_map, true, true, true);
-      // int n_dispersal_cells = total_dispersal_cells(carrying_capacity_available_cleaned);
+    int loopID, dispersal_step, i, j, n, source;
+    r_stream rng;
+
+      /* Only sinks within dispersal distance of an occupied cell can be colonised. Sources only
+      ** lose individuals during a call, so the frontier only ever shrinks. */
+      if(use_frontier) frontier.reset(stencil, starting_population_state);
 
       /* *********************** */
       /* Dispersal starts here.  */
@@ -402,55 +449,625 @@ List rcpp_dispersal(NumericMatrix starting_population_state, NumericMatrix poten
 	    **      (sink pixel) and the pixel that is already colonised (source
 	    **      pixel).
 	    **
-	    ** Loop through the cellular automaton. */
-	    for(i = 0; i < nrows; i++){
-	      for(j = 0; j < ncols; j++){
-
-		    //The are boolean calls which indicate if habitat is suitable and if cell can disperse
-	        habitat_is_suitable = false;
-	        // cell_in_dispersal_distance = false;
-
-	        /* 1. Test whether the pixel is a suitable sink (i.e., its habitat
-	        **    is suitable, it has avaliable carrying capacity, it's not NA and is not on a barrier). */
-	        if((habitat_suitability_map(i,j) > 0) && (carrying_capacity_available_cleaned(i,j) > 0) && !R_IsNA(carrying_capacity_available_cleaned(i,j))) habitat_is_suitable = true;
-
-	        /* 2. Test whether there is a source cell within the dispersal
-	        **    distance. To be more time efficient, this code runs only if
-	        **    the answer to the first question is positive. This is a bit slower,
-	        **	  especially if you include barriers in dispersal step.
-	        **/
-	        if(habitat_is_suitable){
-		      /* Now we search if there is a suitable source cell to colonize the sink cell. */
-	            IntegerVector cell_in_dispersal_distance = can_source_cell_disperse(i, j, starting_population_state, tracking_population_state_cleaned,
-	            habitat_suitability_map, barriers_map, use_barrier, barrier_type, loopID, dispersal_distance, dispersal_kernel);
-	            // Rcpp::Rcout << cell_in_dispersal_distance << std::endl;
-	 	        /* Update sink cell status. */
-    	        if(cell_in_dispersal_distance[0] >= 0 && cell_in_dispersal_distance[1] >= 0){
-    		        /* Only if the 2 conditions are fullfilled the cell's is there dispersal to this cell and the population size is changed. */
-    		        int source_x = cell_in_dispersal_distance[0];
-    		        int source_y = cell_in_dispersal_distance[1];
-    		        // Rcpp::Rcout << source_x << std::endl;
-    		        int source_pop_dispersed = proportion_of_population_to_disperse(source_x, source_y, i, j, starting_population_state,
-    		                                                                        carrying_capacity_available_cleaned, dispersal_proportion);
-    		        future_population_state(i,j) = starting_population_state(i,j) + source_pop_dispersed;
-    		        // future_population_state(source_x,source_y) = starting_population_state(source_x,source_y) - source_pop_dispersed;
-     		        starting_population_state(source_x,source_y) = starting_population_state(source_x,source_y) - source_pop_dispersed;
-    	          if(starting_population_state(source_x,source_y)<0)starting_population_state(source_x,source_y)=0;
-    	          tracking_population_state_cleaned(i,j) = loopID;
-    	          // tracking_population_state_cleaned(source_x,source_y) = loopID;
-    	        }
-	         }
+	    ** Loop through the cellular automaton (or only the sinks on the frontier). */
+	    if(use_frontier){
+	      frontier.compact();
+	      for(n = 0; n < (int) frontier.active.size(); n++){
+	        if(frontier.coverage[frontier.active[n]] <= 0) continue;
+	        i = frontier.active[n] % nrows;
+	        j = frontier.active[n] / nrows;
+	        source = disperse_to_sink(rng, i, j, stencil, starting_population_state, carrying_capacity_available_cleaned,
+	                                  tracking_population_state_cleaned, future_population_state,
+	                                  habitat_suitability_map, barriers, loopID, dispersal_proportion);
+	        /* a source whose population is exhausted can no longer colonise any sink. */
+	        if(source >= 0 && !(starting_population_state[source] > 0)) frontier.update(stencil, source, -1);
 	      }
-	   }
-	for(i = 0; i < nrows; i++){
-	    for(j = 0; j < ncols; j++){
-	        if(R_IsNA(future_population_state(i,j))){
-	          future_population_state(i,j)=starting_population_state(i,j);
-	          if(future_population_state(i,j)<0)future_population_state(i,j)=0;
+	    } else {
+	      for(i = 0; i < nrows; i++){
+	        for(j = 0; j < ncols; j++){
+	          disperse_to_sink(rng, i, j, stencil, starting_population_state, carrying_capacity_available_cleaned,
+	                           tracking_population_state_cleaned, future_population_state,
+	                           habitat_suitability_map, barriers, loopID, dispersal_proportion);
+	        }
 	      }
 	    }
-	  }
+
+	/* Cells that were not colonised keep their (post-dispersal) starting population. After the first
+	** step only NA cells are left unset, and those stay NA, so the frontier only needs this pass once. */
+	if(use_frontier && dispersal_step > 1) continue;
+	fill_undispersed_cells(future_population_state, starting_population_state);
 	}
+}
+
+/*
+** Tiled dispersal: the grid is split into square tiles at least 2 * dispersal distance + 1
+** cells wide and coloured like a 2 x 2 checkerboard. A sink only reads and writes cells
+** within the dispersal distance of itself, so tiles of the same colour never touch the
+** same cells and can be processed concurrently; the four colours are processed in turn.
+** Within a tile, sinks are visited in row-major order. Each sink draws its random numbers
+** from its own counter-based stream keyed on (seed, dispersal step, cell), so the result
+** is the same whatever the number of threads.
+*/
+struct dispersal_tiling {
+  int nrows, ncols, tile_size, n_tile_rows, n_tile_cols;
+
+  dispersal_tiling(int nr, int nc, int dispersal_distance) : nrows(nr), ncols(nc) {
+    tile_size = std::max(2 * dispersal_distance + 1, 32);
+    n_tile_rows = (nrows + tile_size - 1) / tile_size;
+    n_tile_cols = (ncols + tile_size - 1) / tile_size;
+  }
+
+  /* tiles of one checkerboard colour (0 to 3) */
+  std::vector<int> phase(int colour) const {
+    std::vector<int> tiles;
+    for (int tile_row = colour / 2; tile_row < n_tile_rows; tile_row += 2){
+      for (int tile_col = colour % 2; tile_col < n_tile_cols; tile_col += 2){
+        tiles.push_back(tile_row + tile_col * n_tile_rows);
+      }
+    }
+    return tiles;
+  }
+};
+
+/* Summed-area table of occupied cells, used to skip tiles with no source within reach. */
+static void count_occupied_cells(NumericMatrix& population, std::vector<int>& occupied){
+  int nrows = population.nrow(), ncols = population.ncol(), i, j;
+  occupied.assign((nrows + 1) * (ncols + 1), 0);
+  for(j = 0; j < ncols; j++){
+    for(i = 0; i < nrows; i++){
+      occupied[(i + 1) + (j + 1) * (nrows + 1)] = (population(i,j) > 0) +
+        occupied[i + (j + 1) * (nrows + 1)] + occupied[(i + 1) + j * (nrows + 1)] - occupied[i + j * (nrows + 1)];
+    }
+  }
+}
+
+static int occupied_in_box(const std::vector<int>& occupied, int nrows, int row_min, int row_max, int col_min, int col_max){
+  int stride = nrows + 1;
+  return occupied[(row_max + 1) + (col_max + 1) * stride] - occupied[row_min + (col_max + 1) * stride] -
+    occupied[(row_max + 1) + col_min * stride] + occupied[row_min + col_min * stride];
+}
+
+/*
+** disperse_tiled: the tiled, multi-threaded equivalent of disperse_serial. Nothing in
+**            here may call back into R, since it runs on worker threads.
+*/
+static void disperse_tiled(const dispersal_stencil& stencil, NumericMatrix& starting_population_state,
+                           NumericMatrix& carrying_capacity_available_cleaned,
+                           NumericMatrix& tracking_population_state_cleaned,
+                           NumericMatrix& future_population_state,
+                           NumericMatrix& habitat_suitability_map, barrier_paths* barriers,
+                           int dispersal_steps, double dispersal_proportion,
+                           uint64_t stream_seed, int n_threads, std::vector<int>& occupied){
+    int ncols = starting_population_state.ncol();
+    int nrows = starting_population_state.nrow();
+    int dispersal_distance = stencil.distance;
+    int loopID, dispersal_step, colour, t;
+    std::vector<int> tiles;
+    dispersal_tiling tiling(nrows, ncols, dispersal_distance);
+#ifdef STEPS_PROFILE
+    profile_counts gathered;  // the worker threads' counts
+#endif
+
+    loopID = 0;
+    for(dispersal_step = 1; dispersal_step <= dispersal_steps; dispersal_step++){
+      loopID = loopID + 1;
+
+      /* sources only lose individuals during a step, so occupancy at the start of the step is enough to skip tiles. */
+      count_occupied_cells(starting_population_state, occupied);
+
+      for(colour = 0; colour < 4; colour++){
+        tiles = tiling.phase(colour);
+        int n_tiles = tiles.size();
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(n_threads)
+#endif
+        for(t = 0; t < n_tiles; t++){
+          int tile_row = tiles[t] % tiling.n_tile_rows;
+          int tile_col = tiles[t] / tiling.n_tile_rows;
+          int row_min = tile_row * tiling.tile_size;
+          int row_max = std::min(row_min + tiling.tile_size, nrows) - 1;
+          int col_min = tile_col * tiling.tile_size;
+          int col_max = std::min(col_min + tiling.tile_size, ncols) - 1;
+
+          if(occupied_in_box(occupied, nrows,
+                             std::max(row_min - dispersal_distance, 0), std::min(row_max + dispersal_distance, nrows - 1),
+                             std::max(col_min - dispersal_distance, 0), std::min(col_max + dispersal_distance, ncols - 1)) == 0) continue;
+
+          for(int i = row_min; i <= row_max; i++){
+            for(int j = col_min; j <= col_max; j++){
+              counter_stream rng(stream_seed, dispersal_step, i + j * nrows);
+              disperse_to_sink(rng, i, j, stencil, starting_population_state, carrying_capacity_available_cleaned,
+                               tracking_population_state_cleaned, future_population_state,
+                               habitat_suitability_map, barriers, loopID, dispersal_proportion);
+            }
+          }
+#ifdef STEPS_PROFILE
+          profile_take(gathered);
+#endif
+        }
+      }
+
+      fill_undispersed_cells(future_population_state, starting_population_state);
+    }
+#ifdef STEPS_PROFILE
+    profile_give(gathered);
+#endif
+}
+
+// //' dispersal function for dynamic metapopulation models
+// //' @param current_distribution raster of current population distribution.
+// //' @param habitat_suitability raster of habitat suitability that has been converted to carrying capacity
+// //' @param barrier_map raster of barriers to the dispersal, 1=barrier; 0=no barrier.
+// //' @param barrier_type if 0 weak barrier, if 1 strong barriers.
+// //' @param use_barrier if true use barriers in dispersal analysis.
+// //' @param dispersal_steps The number of dispersal iterations per C++ call.
+// //' @param dispersal_distance The maximum number of cells the species can disperse.
+// //' @param dispersal_kernal a numeric vector of probabilites of dispersing from one to n cells, where n is the dispersal distance.
+// //' @param dispersal_proportion the proportion of species that will disperse from source cell, needs to be between 0 and 1. e.g 0.2 means that 20% of the cell's population disperses. 
+// //' @param use_frontier if true only visit sinks within dispersal distance of an occupied cell (same outcome, faster on sparse landscapes).
+// //' @param skip_sampling if true sample each sink's source by skipping between candidates (see skip_dispersal_stencil): sources are chosen with the same probabilities, from far fewer random draws, but not by the same draws.
+// [[Rcpp::export]]
+List rcpp_dispersal(NumericMatrix starting_population_state, NumericMatrix potential_carrying_capacity,
+  NumericMatrix habitat_suitability_map,NumericMatrix barriers_map, int barrier_type, bool use_barrier, int dispersal_steps,
+  int dispersal_distance, NumericVector dispersal_kernel, double dispersal_proportion, bool use_frontier = false,
+  bool skip_sampling = false){
+
+	  int ncols = starting_population_state.ncol();
+    int nrows = starting_population_state.nrow();
+    NumericMatrix carrying_capacity_available_cleaned(nrows,ncols); // carrying capacity avaliable.
+    NumericMatrix tracking_population_state_cleaned(nrows,ncols); // tracking population state.
+    NumericMatrix future_population_state = na_matrix(nrows,ncols); // future population size (after dispersal).
+    dispersal_frontier frontier(0, 0);
+
+    // offsets within the dispersal distance and their kernel values are the same for every sink, so build them once.
+    dispersal_stencil stencil = build_dispersal_stencil(dispersal_distance, dispersal_kernel, nrows, skip_sampling);
+    std::unique_ptr<barrier_paths> barriers;
+    if(use_barrier) barriers.reset(new barrier_paths(stencil, barriers_map, barrier_type));
+
+    prepare_dispersal_state(starting_population_state, potential_carrying_capacity, barriers_map,
+                            carrying_capacity_available_cleaned, tracking_population_state_cleaned);
+
+    disperse_serial(stencil, starting_population_state, carrying_capacity_available_cleaned,
+                    tracking_population_state_cleaned, future_population_state, habitat_suitability_map,
+                    barriers.get(), dispersal_steps, dispersal_proportion, use_frontier, frontier);
+
   return(List::create(Named("dispersed_population") = future_population_state,
                       Named("tracked_population") = tracking_population_state_cleaned));/* end of dispersal */
-}
\ No newline at end of file
+}
+
+// //' tiled, multi-threaded version of rcpp_dispersal with reproducible per-cell random streams
+// //' @param seed seed for the counter-based random number streams.
+// //' @param n_threads number of threads to use (results do not depend on it).
+// //' @param skip_sampling as for rcpp_dispersal.
+// [[Rcpp::export]]
+List rcpp_dispersal_tiled(NumericMatrix starting_population_state, NumericMatrix potential_carrying_capacity,
+  NumericMatrix habitat_suitability_map, NumericMatrix barriers_map, int barrier_type, bool use_barrier, int dispersal_steps,
+  int dispersal_distance, NumericVector dispersal_kernel, double dispersal_proportion, double seed, int n_threads = 1,
+  bool skip_sampling = false){
+
+    int ncols = starting_population_state.ncol();
+    int nrows = starting_population_state.nrow();
+    NumericMatrix carrying_capacity_available_cleaned(nrows,ncols);
+    NumericMatrix tracking_population_state_cleaned(nrows,ncols);
+    NumericMatrix future_population_state = na_matrix(nrows,ncols); // future population size (after dispersal).
+    std::vector<int> occupied;
+
+    dispersal_stencil stencil = build_dispersal_stencil(dispersal_distance, dispersal_kernel, nrows, skip_sampling);
+    std::unique_ptr<barrier_paths> barriers;
+    if(use_barrier) barriers.reset(new barrier_paths(stencil, barriers_map, barrier_type));
+
+    prepare_dispersal_state(starting_population_state, potential_carrying_capacity, barriers_map,
+                            carrying_capacity_available_cleaned, tracking_population_state_cleaned);
+
+    disperse_tiled(stencil, starting_population_state, carrying_capacity_available_cleaned,
+                   tracking_population_state_cleaned, future_population_state, habitat_suitability_map,
+                   barriers.get(), dispersal_steps, dispersal_proportion, (uint64_t) seed, n_threads, occupied);
+
+  return(List::create(Named("dispersed_population") = future_population_state,
+                      Named("tracked_population") = tracking_population_state_cleaned));
+}
+
+/*
+** dispersal_workspace: scratch buffers for rcpp_dispersal_stages, kept between calls
+**            (e.g. across stages, timesteps and replicates) so that they are only
+**            allocated when the landscape dimensions change. Stencils are cached per
+**            stage and rebuilt only when the distance, kernel or sampling changes;
+**            barrier paths are kept for the last few barrier layers, distances and
+**            barrier types.
+**            The habitat suitability and carrying capacity maps are filled from a
+**            landscape state by rcpp_landscape_dispersal.
+*/
+struct dispersal_workspace {
+  int nrows;
+  int ncols;
+  NumericMatrix starting_population_state;
+  NumericMatrix carrying_capacity_available_cleaned;
+  NumericMatrix tracking_population_state_cleaned;
+  NumericMatrix future_population_state;
+  NumericMatrix habitat_suitability_map;
+  NumericMatrix potential_carrying_capacity;
+  dispersal_frontier frontier;
+  std::vector<int> occupied;
+  std::vector<dispersal_stencil> stencils;
+  std::vector<std::shared_ptr<barrier_paths> > paths;
+
+  dispersal_workspace() : nrows(0), ncols(0), frontier(0, 0) {}
+
+  void resize(int nr, int nc){
+    if(nr == nrows && nc == ncols) return;
+    nrows = nr;
+    ncols = nc;
+    starting_population_state = NumericMatrix(nrows, ncols);
+    carrying_capacity_available_cleaned = NumericMatrix(nrows, ncols);
+    tracking_population_state_cleaned = NumericMatrix(nrows, ncols);
+    future_population_state = NumericMatrix(nrows, ncols);
+    habitat_suitability_map = NumericMatrix(nrows, ncols);
+    potential_carrying_capacity = NumericMatrix(nrows, ncols);
+    stencils.clear();
+    paths.clear();
+  }
+
+  const dispersal_stencil& stencil(int stage, int dispersal_distance, const NumericVector& dispersal_kernel,
+                                   bool skip_sampling){
+    if((int) stencils.size() <= stage) stencils.resize(stage + 1);
+    dispersal_stencil& cached = stencils[stage];
+    bool current = (cached.nrows == nrows) && (cached.distance == dispersal_distance) && (cached.skip == skip_sampling);
+    for(int n = 0; current && n < cached.size(); n++){
+      if(cached.weight[n] != dispersal_kernel[cached.ring[n] - 1]) current = false;
+    }
+    if(!current) cached = build_dispersal_stencil(dispersal_distance, dispersal_kernel, nrows, skip_sampling);
+    return cached;
+  }
+
+  /* barrier paths (and their cached status) are kept until the barrier layer changes. */
+  barrier_paths* barriers(const dispersal_stencil& stencil, NumericMatrix& barriers_map, int barrier_type){
+    for(size_t n = 0; n < paths.size(); n++){
+      if(paths[n]->built_for(stencil, barriers_map, barrier_type)) return paths[n].get();
+    }
+    if(paths.size() >= 4) paths.clear();
+    paths.push_back(std::make_shared<barrier_paths>(stencil, barriers_map, barrier_type));
+    return paths.back().get();
+  }
+};
+
+// //' create a workspace to be reused by calls to rcpp_dispersal_stages
+// //' @param workspace an existing workspace, returned as is if it is still valid (workspaces do not survive serialisation).
+// [[Rcpp::export]]
+SEXP rcpp_dispersal_workspace(SEXP workspace = R_NilValue){
+  if(TYPEOF(workspace) == EXTPTRSXP && R_ExternalPtrAddr(workspace) != NULL) return workspace;
+  XPtr<dispersal_workspace> new_workspace(new dispersal_workspace(), true);
+  return new_workspace;
+}
+
+/* the workspace behind an external pointer, or the temporary one if it is not valid */
+static dispersal_workspace* use_workspace(SEXP workspace, dispersal_workspace* temporary_workspace){
+  if(TYPEOF(workspace) == EXTPTRSXP && R_ExternalPtrAddr(workspace) != NULL){
+    return XPtr<dispersal_workspace>(workspace).get();
+  }
+  return temporary_workspace;
+}
+
+/* Disperse one stage from the workspace's starting population state into its future population state. */
+static void disperse_stage(dispersal_workspace* ws, int stage, NumericMatrix& potential_carrying_capacity,
+  NumericMatrix& habitat_suitability_map, NumericMatrix& barriers_map, int barrier_type, bool use_barrier,
+  int dispersal_steps, int dispersal_distance, const NumericVector& dispersal_kernel, double dispersal_proportion,
+  bool use_frontier, double seed, int n_threads, bool skip_sampling){
+
+    const dispersal_stencil& stencil = ws->stencil(stage, dispersal_distance, dispersal_kernel, skip_sampling);
+    barrier_paths* barriers = use_barrier ? ws->barriers(stencil, barriers_map, barrier_type) : NULL;
+
+    std::fill(ws->future_population_state.begin(), ws->future_population_state.end(), NA_REAL);
+
+    prepare_dispersal_state(ws->starting_population_state, potential_carrying_capacity, barriers_map,
+                            ws->carrying_capacity_available_cleaned, ws->tracking_population_state_cleaned);
+
+    if(n_threads > 1){
+      disperse_tiled(stencil, ws->starting_population_state, ws->carrying_capacity_available_cleaned,
+                     ws->tracking_population_state_cleaned, ws->future_population_state, habitat_suitability_map,
+                     barriers, dispersal_steps, dispersal_proportion,
+                     mix_seed((uint64_t) seed, stage), n_threads, ws->occupied);
+    } else {
+      disperse_serial(stencil, ws->starting_population_state, ws->carrying_capacity_available_cleaned,
+                      ws->tracking_population_state_cleaned, ws->future_population_state, habitat_suitability_map,
+                      barriers, dispersal_steps, dispersal_proportion, use_frontier, ws->frontier);
+    }
+}
+
+// //' multi-stage dispersal: disperse all stages in one call, sharing the landscape layers and scratch buffers.
+// //' @param population a cells x stages matrix of the populations to disperse, with cells in the (column-major) order of the landscape matrices.
+// //' @param dispersal_distance, dispersal_kernel, dispersal_proportion per-stage distance, kernel (a list of numeric vectors) and proportion.
+// //' @param seed seed for the tiled engine (only used if n_threads > 1).
+// //' @param workspace a workspace created by rcpp_dispersal_workspace, or NULL. Workspaces do not survive serialisation, and an invalid workspace is replaced by a temporary one.
+// //' @param skip_sampling as for rcpp_dispersal.
+// //' @return the cells x stages matrix of dispersed populations.
+// [[Rcpp::export]]
+NumericMatrix rcpp_dispersal_stages(NumericMatrix population, NumericMatrix potential_carrying_capacity,
+  NumericMatrix habitat_suitability_map, NumericMatrix barriers_map, int barrier_type, bool use_barrier, int dispersal_steps,
+  IntegerVector dispersal_distance, List dispersal_kernel, NumericVector dispersal_proportion, bool use_frontier = false,
+  double seed = 0, int n_threads = 1, SEXP workspace = R_NilValue, bool skip_sampling = false){
+
+    int nrows = habitat_suitability_map.nrow();
+    int ncols = habitat_suitability_map.ncol();
+    int n_cells = nrows * ncols;
+    int n_stages = population.ncol();
+    int stage;
+
+    if(population.nrow() != n_cells){
+      stop("the population must have one row per cell of the landscape");
+    }
+    if(dispersal_distance.size() != n_stages || dispersal_kernel.size() != n_stages ||
+       dispersal_proportion.size() != n_stages){
+      stop("dispersal distance, kernel and proportion must be given for each stage");
+    }
+
+    dispersal_workspace temporary_workspace;
+    dispersal_workspace* ws = use_workspace(workspace, &temporary_workspace);
+    ws->resize(nrows, ncols);
+
+    NumericMatrix dispersed_population(n_cells, n_stages);
+
+    for(stage = 0; stage < n_stages; stage++){
+      NumericVector stage_kernel = dispersal_kernel[stage];
+      std::copy(population.begin() + stage * n_cells, population.begin() + (stage + 1) * n_cells,
+                ws->starting_population_state.begin());
+
+      disperse_stage(ws, stage, potential_carrying_capacity, habitat_suitability_map, barriers_map, barrier_type,
+                     use_barrier, dispersal_steps, dispersal_distance[stage], stage_kernel, dispersal_proportion[stage],
+                     use_frontier, seed, n_threads, skip_sampling);
+
+      std::copy(ws->future_population_state.begin(), ws->future_population_state.end(),
+                dispersed_population.begin() + stage * n_cells);
+    }
+
+  return dispersed_population;
+}
+
+/*
+** Multi-stage dispersal of the population in a landscape state, in place.
+** arrival_layer and capacity_layer are the landscape layers giving arrival
+** probabilities and carrying capacity, and stages the (one-based) stages to
+** disperse, with dispersal_distance, dispersal_kernel and dispersal_proportion
+** given for each of them. Other arguments are as for rcpp_dispersal_stages.
+** Individuals only disperse between non-NA cells of the landscape.
+*/
+void landscape_dispersal(landscape_state& landscape, const std::string& arrival_layer, const std::string& capacity_layer,
+  NumericMatrix barriers_map, int barrier_type, bool use_barrier, int dispersal_steps, const IntegerVector& stages,
+  const IntegerVector& dispersal_distance, const List& dispersal_kernel, const NumericVector& dispersal_proportion,
+  bool use_frontier, double seed, int n_threads, SEXP workspace, bool skip_sampling){
+
+    int n_stages = stages.size();
+    int n;
+
+    if(barriers_map.nrow() != landscape.nrows || barriers_map.ncol() != landscape.ncols){
+      stop("the barriers map must have the dimensions of the landscape");
+    }
+    if(dispersal_distance.size() != n_stages || dispersal_kernel.size() != n_stages ||
+       dispersal_proportion.size() != n_stages){
+      stop("dispersal distance, kernel and proportion must be given for each stage");
+    }
+    for(n = 0; n < n_stages; n++){
+      if(stages[n] < 1 || stages[n] > landscape.n_stages) stop("stages must be between 1 and the number of stages");
+    }
+
+    dispersal_workspace temporary_workspace;
+    dispersal_workspace* ws = use_workspace(workspace, &temporary_workspace);
+    ws->resize(landscape.nrows, landscape.ncols);
+
+    landscape.scatter(landscape.layer(arrival_layer), ws->habitat_suitability_map.begin());
+    landscape.scatter(landscape.layer(capacity_layer), ws->potential_carrying_capacity.begin());
+
+    /* stages are numbered as in rcpp_dispersal_stages (for the stencil cache and random seeds) */
+    for(n = 0; n < n_stages; n++){
+      NumericVector stage_kernel = dispersal_kernel[n];
+      landscape.scatter_stage(stages[n] - 1, ws->starting_population_state.begin());
+
+      disperse_stage(ws, n, ws->potential_carrying_capacity, ws->habitat_suitability_map, barriers_map, barrier_type,
+                     use_barrier, dispersal_steps, dispersal_distance[n], stage_kernel, dispersal_proportion[n],
+                     use_frontier, seed, n_threads, skip_sampling);
+
+      landscape.gather_stage(ws->future_population_state.begin(), stages[n] - 1);
+    }
+}
+
+/* per-thread scratch buffers of replicate dispersal steps */
+struct dispersal_scratch {
+  NumericMatrix starting_population_state;
+  NumericMatrix carrying_capacity_available_cleaned;
+  NumericMatrix tracking_population_state_cleaned;
+  NumericMatrix future_population_state;
+  std::vector<int> occupied;
+};
+
+/*
+** dispersal_artifacts: what replicate dispersal steps build before they run,
+**            shared by the steps prepared for many simulations (e.g. the
+**            scenarios of a sweep, see rcpp_simulate_sweep). Steps with the same
+**            distance, kernel and sampling share a stencil; those with the same
+**            stencil distance and barrier layer share barrier paths (and what
+**            they have cached); those reading the same habitat layer of a
+**            landscape share its map; and since a worker thread only runs one
+**            step at a time, all steps share each thread's scratch buffers.
+**
+**            With a cache directory, what barrier paths find (which can take
+**            far longer than the dispersal itself, and is the same for every
+**            simulation with the same stencil distance and barrier layer) is
+**            read from the cache when they are built, and saved there by
+**            save_cache(), in a file named by the paths' key (see
+**            barrier_paths::save). Stencils and maps are quick to rebuild, so
+**            are not cached.
+*/
+class dispersal_artifacts {
+public:
+  explicit dispersal_artifacts(const std::string& cache_dir = "") : cache_dir(cache_dir) {}
+
+  std::shared_ptr<const dispersal_stencil> stencil(int dispersal_distance, const NumericVector& dispersal_kernel,
+                                                   int nrows, bool skip_sampling){
+    for(size_t s = 0; s < stencils.size(); s++){
+      const dispersal_stencil& cached = *stencils[s];
+      bool current = (cached.nrows == nrows) && (cached.distance == dispersal_distance) && (cached.skip == skip_sampling);
+      for(int n = 0; current && n < cached.size(); n++){
+        if(cached.weight[n] != dispersal_kernel[cached.ring[n] - 1]) current = false;
+      }
+      if(current) return stencils[s];
+    }
+    stencils.push_back(std::make_shared<const dispersal_stencil>(
+      build_dispersal_stencil(dispersal_distance, dispersal_kernel, nrows, skip_sampling)));
+    return stencils.back();
+  }
+
+  std::shared_ptr<barrier_paths> barriers(const dispersal_stencil& stencil, const NumericMatrix& barriers_map,
+                                          int barrier_type){
+    for(size_t n = 0; n < paths.size(); n++){
+      if(paths[n]->built_for(stencil, barriers_map, barrier_type)) return paths[n];
+    }
+    paths.push_back(std::make_shared<barrier_paths>(stencil, barriers_map, barrier_type));
+    if(!cache_dir.empty() && paths.back()->cacheable()){
+      uint64_t key = paths.back()->key();
+      char name[32];
+      std::snprintf(name, sizeof(name), "barriers-%016llx.bin", (unsigned long long) key);
+      cached.push_back(std::make_pair(paths.back(), std::make_pair(key, cache_dir + "/" + name)));
+      paths.back()->load(cached.back().second.second, key);
+    }
+    return paths.back();
+  }
+
+  /* save what the barrier paths have found to the cache directory; false if any couldn't be */
+  bool save_cache() const {
+    bool saved = true;
+    for(size_t n = 0; n < cached.size(); n++){
+      saved = cached[n].first->save(cached[n].second.second, cached[n].second.first) && saved;
+    }
+    return saved;
+  }
+
+  /* a habitat layer of a landscape, scattered into a landscape matrix */
+  NumericMatrix map(const landscape_state& landscape, const std::string& layer){
+    const habitat_layer* values = &landscape.layer(layer);
+    for(size_t n = 0; n < maps.size(); n++){
+      if(maps[n].first.get() == values) return maps[n].second;
+    }
+    NumericMatrix scattered(landscape.nrows, landscape.ncols);
+    landscape.scatter(*values, scattered.begin());
+    /* the layer is kept, so that its address can't be reused by another */
+    maps.push_back(std::make_pair(landscape.layers.find(layer)->second, scattered));
+    return scattered;
+  }
+
+  /* scratch buffers for n_threads worker threads on an nrows x ncols landscape */
+  std::shared_ptr<std::vector<dispersal_scratch> > scratch(int nrows, int ncols, int n_threads){
+    for(size_t n = 0; n < workers.size(); n++){
+      std::vector<dispersal_scratch>& buffers = *workers[n];
+      if(buffers[0].future_population_state.nrow() != nrows || buffers[0].future_population_state.ncol() != ncols) continue;
+      add_scratch(buffers, nrows, ncols, n_threads);
+      return workers[n];
+    }
+    workers.push_back(std::make_shared<std::vector<dispersal_scratch> >());
+    add_scratch(*workers.back(), nrows, ncols, n_threads);
+    return workers.back();
+  }
+
+private:
+  std::string cache_dir;
+  std::vector<std::shared_ptr<const dispersal_stencil> > stencils;
+  std::vector<std::shared_ptr<barrier_paths> > paths;
+  std::vector<std::pair<std::shared_ptr<barrier_paths>, std::pair<uint64_t, std::string> > > cached;  // with key and file
+  std::vector<std::pair<std::shared_ptr<const habitat_layer>, NumericMatrix> > maps;
+  std::vector<std::shared_ptr<std::vector<dispersal_scratch> > > workers;
+
+  static void add_scratch(std::vector<dispersal_scratch>& buffers, int nrows, int ncols, int n_threads){
+    for(int t = buffers.size(); t < n_threads; t++){
+      dispersal_scratch added;
+      added.starting_population_state = NumericMatrix(nrows, ncols);
+      added.carrying_capacity_available_cleaned = NumericMatrix(nrows, ncols);
+      added.tracking_population_state_cleaned = NumericMatrix(nrows, ncols);
+      added.future_population_state = NumericMatrix(nrows, ncols);
+      buffers.push_back(added);
+    }
+  }
+};
+
+std::shared_ptr<dispersal_artifacts> shared_dispersal_artifacts(const std::string& cache_dir){
+  return std::make_shared<dispersal_artifacts>(cache_dir);
+}
+
+bool save_dispersal_artifacts(const dispersal_artifacts& artifacts){
+  return artifacts.save_cache();
+}
+
+/*
+** Dispersal for replicates: the arrival probability and carrying capacity
+** maps, stencils and barrier paths are built once (or taken from artifacts
+** shared with other simulations) and shared by all replicates, and each
+** worker thread has its own scratch buffers. Stages are dispersed by the
+** tiled engine on the worker's own thread, with per-cell streams seeded for
+** each stage.
+*/
+class replicate_dispersal_step : public replicate_step {
+public:
+  replicate_dispersal_step(const landscape_state& landscape, const std::string& arrival_layer,
+    const std::string& capacity_layer, NumericMatrix barriers_map, int barrier_type, bool use_barrier,
+    int dispersal_steps, const IntegerVector& stages, const IntegerVector& dispersal_distance,
+    const List& dispersal_kernel, const NumericVector& dispersal_proportion, int n_threads, bool skip_sampling,
+    dispersal_artifacts& artifacts) :
+    barriers_map(barriers_map), stages(stages), dispersal_proportion(dispersal_proportion),
+    dispersal_steps(dispersal_steps) {
+
+    int n_stages = stages.size();
+
+    if(barriers_map.nrow() != landscape.nrows || barriers_map.ncol() != landscape.ncols){
+      stop("the barriers map must have the dimensions of the landscape");
+    }
+    if(dispersal_distance.size() != n_stages || dispersal_kernel.size() != n_stages ||
+       dispersal_proportion.size() != n_stages){
+      stop("dispersal distance, kernel and proportion must be given for each stage");
+    }
+
+    habitat_suitability_map = artifacts.map(landscape, arrival_layer);
+    potential_carrying_capacity = artifacts.map(landscape, capacity_layer);
+
+    for(int n = 0; n < n_stages; n++){
+      if(stages[n] < 1 || stages[n] > landscape.n_stages) stop("stages must be between 1 and the number of stages");
+      stencils.push_back(artifacts.stencil(dispersal_distance[n], dispersal_kernel[n], landscape.nrows, skip_sampling));
+      barriers.push_back(use_barrier ? artifacts.barriers(*stencils[n], barriers_map, barrier_type) :
+                                       std::shared_ptr<barrier_paths>());
+    }
+
+    workers = artifacts.scratch(landscape.nrows, landscape.ncols, n_threads);
+  }
+
+  void run(landscape_state& landscape, uint64_t seed, int thread){
+    dispersal_scratch& ws = (*workers)[thread];
+    for(int n = 0; n < stages.size(); n++){
+      landscape.scatter_stage(stages[n] - 1, ws.starting_population_state.begin());
+      std::fill(ws.future_population_state.begin(), ws.future_population_state.end(), NA_REAL);
+      prepare_dispersal_state(ws.starting_population_state, potential_carrying_capacity, barriers_map,
+                              ws.carrying_capacity_available_cleaned, ws.tracking_population_state_cleaned);
+      disperse_tiled(*stencils[n], ws.starting_population_state, ws.carrying_capacity_available_cleaned,
+                     ws.tracking_population_state_cleaned, ws.future_population_state, habitat_suitability_map,
+                     barriers[n].get(), dispersal_steps, dispersal_proportion[n], mix_seed(seed, n), 1, ws.occupied);
+      landscape.gather_stage(ws.future_population_state.begin(), stages[n] - 1);
+    }
+  }
+
+private:
+  NumericMatrix barriers_map;
+  NumericMatrix habitat_suitability_map;
+  NumericMatrix potential_carrying_capacity;
+  IntegerVector stages;
+  NumericVector dispersal_proportion;
+  int dispersal_steps;
+  std::vector<std::shared_ptr<const dispersal_stencil> > stencils;
+  std::vector<std::shared_ptr<barrier_paths> > barriers;
+  std::shared_ptr<std::vector<dispersal_scratch> > workers;
+};
+
+std::unique_ptr<replicate_step> replicate_dispersal(const landscape_state& landscape, const std::string& arrival_layer,
+  const std::string& capacity_layer, NumericMatrix barriers_map, int barrier_type, bool use_barrier, int dispersal_steps,
+  const IntegerVector& stages, const IntegerVector& dispersal_distance, const List& dispersal_kernel,
+  const NumericVector& dispersal_proportion, int n_threads, bool skip_sampling, dispersal_artifacts* artifacts){
+  dispersal_artifacts own_artifacts;
+  return std::unique_ptr<replicate_step>(new replicate_dispersal_step(landscape, arrival_layer, capacity_layer,
+    barriers_map, barrier_type, use_barrier, dispersal_steps, stages, dispersal_distance, dispersal_kernel,
+    dispersal_proportion, n_threads, skip_sampling, artifacts != NULL ? *artifacts : own_artifacts));
+}
@@ -0,0 +1,507 @@
+#include <Rcpp.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include "landscape_state.h"
+#include "random_streams.h"
+#include "simulation_results.h"
+#include "profile_counters.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+using namespace Rcpp;
+
+/*
+** Running a simulation's timesteps natively.
+**
+** The dynamics of a simulation are given as a sequence of steps. Built-in
+** dynamics are described in R by the list made by their native_step() (a type
+** and its parameters), and run here on the landscape state without returning
+** to R; any other dynamic has type "r" and is called back in R at its place in
+** the sequence. Transition matrices are read from the demography, which can
+** only change in R dynamics (built-in demography density dependence scales
+** them through the landscape state instead).
+**
+** When all the dynamics are built-in, replicates can instead be run together:
+** the steps are prepared once (see replicate_step in landscape_state.h) and
+** each replicate runs on a worker thread with its own copy of the population,
+** sharing the habitat layers, stencils and barrier paths. The replicates of a
+** sweep's scenarios (variants of a simulation, see simulation_sweep() in R)
+** are run the same way, as one pool of runs, and their dispersal steps share
+** whatever they can build once (see dispersal_artifacts). What their barrier
+** paths find can be cached on disk for later simulations, and replicates can
+** be checkpointed (see checkpoint_file in simulation_results.h) so that a
+** simulation that is stopped can carry on where it left off.
+**
+** Simulations can be profiled: the wall time of each native step, and the
+** counts of work (see profile_counters.h) each step did, are then kept for
+** every step. R dynamics are timed in R.
+*/
+
+#ifdef STEPS_PROFILE
+thread_local unsigned long long profile_thread_counts[n_profile_counters];
+#endif
+
+/* The wall time and work counts of each step of a simulation, summed over timesteps. */
+class step_profile {
+public:
+  explicit step_profile(int n_steps) : seconds(n_steps, 0.0), counts(n_steps) {}
+
+  void start(){ started = std::chrono::steady_clock::now(); }
+
+  /* step i has run since start() (on this thread) */
+  void stop(int i){
+    seconds[i] += std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    profile_take(counts[i]);
+  }
+
+  /* the counts of step i, which wasn't timed */
+  void count(int i){ profile_take(counts[i]); }
+
+  List results() const {
+    int n_steps = seconds.size();
+    NumericMatrix counters(n_steps, n_profile_counters);
+    CharacterVector names(n_profile_counters);
+    for (int c = 0; c < n_profile_counters; c++){
+      names[c] = profile_counter_names[c];
+      for (int i = 0; i < n_steps; i++) counters(i, c) = (double) counts[i].count[c];
+    }
+    colnames(counters) = names;
+    return List::create(Named("seconds") = NumericVector(seconds.begin(), seconds.end()),
+                        Named("counters") = counters);
+  }
+
+private:
+  std::vector<double> seconds;
+  std::vector<profile_counts> counts;
+  std::chrono::steady_clock::time_point started;
+};
+
+/* drop any counts this thread made outside of a profiled simulation */
+static void discard_counts(){
+  profile_counts discarded;
+  profile_take(discarded);
+}
+
+// //' were the dispersal profiling counters compiled in (with STEPS_PROFILE defined)?
+// [[Rcpp::export]]
+bool rcpp_profile_counters_enabled(){
+#ifdef STEPS_PROFILE
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* Run one native step on a landscape state; returns whether the population may have changed. */
+static bool landscape_step(landscape_state& landscape, const List& step, const List& demography){
+  std::string type = as<std::string>(step["type"]);
+
+  if (type == "stage_projection"){
+    landscape_stage_projection(landscape, transition_matrices(demography), as<bool>(step["demo_stoch"]));
+
+  } else if (type == "dispersal"){
+    int n_threads = as<int>(step["n_threads"]);
+    /* the tiled engine's per-cell streams are seeded from R's generator, so set.seed() still applies */
+    double seed = 0;
+    if (n_threads > 1){
+      Function draw_seed = step["seed"];
+      seed = as<double>(draw_seed());
+    }
+    landscape_dispersal(landscape, as<std::string>(step["arrival_layer"]), as<std::string>(step["capacity_layer"]),
+                        NumericMatrix(step["barriers"]), as<int>(step["barrier_type"]), as<bool>(step["use_barriers"]),
+                        as<int>(step["dispersal_steps"]), IntegerVector(step["stages"]),
+                        IntegerVector(step["dispersal_distance"]), List(step["dispersal_kernel"]),
+                        NumericVector(step["dispersal_proportion"]), as<bool>(step["use_frontier"]), seed,
+                        n_threads, step["workspace"], as<bool>(step["skip_sampling"]));
+
+  } else if (type == "density_dependence"){
+    landscape_density_dependence(landscape, as<std::string>(step["capacity_layer"]), IntegerVector(step["stages"]));
+
+  } else if (type == "demography_density_dependence"){
+    /* this only sets multipliers for the next stage projection */
+    landscape_demography_density_dependence(landscape, as<std::string>(step["capacity_layer"]),
+                                            as<double>(step["fecundity_fraction"]),
+                                            as<double>(step["survival_fraction"]), transition_matrices(demography).local);
+    return false;
+
+  } else if (type == "none"){
+    return false;
+
+  } else {
+    stop("unknown native step '" + type + "'");
+  }
+
+  return true;
+}
+
+// //' run one built-in dynamic (described by its native_step()) on a landscape state, in place.
+// [[Rcpp::export]]
+void rcpp_landscape_step(SEXP landscape, List step, List demography){
+  landscape_step(*landscape_pointer(landscape), step, demography);
+}
+
+// //' run the dynamics of a simulation, in order, for each timestep.
+// //' @param steps the native steps of the dynamics, or list(type = "r") for those run in R.
+// //' @param landscape,demography the landscape state and demography at the start of the simulation.
+// //' @param run_dynamic an R function(i, timestep, changed) running the i-th (one-based) dynamic in R, where changed says whether native steps have changed the population since the last call back. It returns a list of the (possibly rebuilt) landscape state and the demography.
+// //' @param record an R function(timestep, changed) called at the end of each timestep.
+// //' @param profile should the simulation be profiled?
+// //' @return NULL, or if profiling, a list of the seconds each native step took and a steps x counters matrix of the work each step did (both summed over timesteps).
+// [[Rcpp::export]]
+SEXP rcpp_simulate(List steps, IntegerVector timesteps, SEXP landscape, List demography,
+                   Function run_dynamic, Function record, bool profile = false){
+  int n_steps = steps.size();
+  std::vector<bool> native(n_steps);
+  List current = List::create(Named("landscape") = landscape, Named("demography") = demography);
+  bool changed = false;
+  step_profile profiled(profile ? n_steps : 0);
+  discard_counts();
+
+  for (int i = 0; i < n_steps; i++){
+    List step = steps[i];
+    native[i] = as<std::string>(step["type"]) != "r";
+  }
+
+  for (int t = 0; t < timesteps.size(); t++){
+    for (int i = 0; i < n_steps; i++){
+      if (native[i]){
+        List step = steps[i];
+        if (profile) profiled.start();
+        changed = landscape_step(*landscape_pointer(current["landscape"]), step, current["demography"]) || changed;
+        if (profile) profiled.stop(i);
+      } else {
+        current = run_dynamic(i + 1, timesteps[t], changed);
+        changed = false;
+        if (profile) profiled.count(i);
+      }
+    }
+    record(timesteps[t], changed);
+    changed = false;
+  }
+
+  if (!profile) return R_NilValue;
+  return profiled.results();
+}
+
+/* Prepare the native steps of a simulation for replicates run on n_threads worker threads. */
+static std::vector<std::unique_ptr<replicate_step> > prepare_steps(const landscape_state& landscape, const List& steps,
+                                                                   const List& demography, int n_threads,
+                                                                   dispersal_artifacts* artifacts = NULL){
+  std::vector<std::unique_ptr<replicate_step> > prepared;
+
+  for (int i = 0; i < steps.size(); i++){
+    List step = steps[i];
+    std::string type = as<std::string>(step["type"]);
+
+    if (type == "stage_projection"){
+      prepared.push_back(replicate_stage_projection(landscape, transition_matrices(demography), as<bool>(step["demo_stoch"])));
+
+    } else if (type == "dispersal"){
+      prepared.push_back(replicate_dispersal(landscape, as<std::string>(step["arrival_layer"]),
+                                             as<std::string>(step["capacity_layer"]), NumericMatrix(step["barriers"]),
+                                             as<int>(step["barrier_type"]), as<bool>(step["use_barriers"]),
+                                             as<int>(step["dispersal_steps"]), IntegerVector(step["stages"]),
+                                             IntegerVector(step["dispersal_distance"]), List(step["dispersal_kernel"]),
+                                             NumericVector(step["dispersal_proportion"]), n_threads,
+                                             as<bool>(step["skip_sampling"]), artifacts));
+
+    } else if (type == "density_dependence"){
+      prepared.push_back(replicate_density_dependence(landscape, as<std::string>(step["capacity_layer"]),
+                                                      IntegerVector(step["stages"])));
+
+    } else if (type == "demography_density_dependence"){
+      prepared.push_back(replicate_demography_density_dependence(landscape, as<std::string>(step["capacity_layer"]),
+                                                                 as<double>(step["fecundity_fraction"]),
+                                                                 as<double>(step["survival_fraction"]),
+                                                                 transition_matrices(demography).local));
+
+    } else if (type != "none"){
+      stop("replicates can only be run together when all of the dynamics are built-in");
+    }
+  }
+
+  return prepared;
+}
+
+/*
+** Keys of simulated models, so that a checkpoint file made for another model
+** is not carried on from: hashes (with mix_seed, like barrier_paths::key()) of
+** a scenario's starting population and habitat layers, and of the values of
+** its native steps and demography. Functions (the dispersal seed generators),
+** environments and external pointers (dispersal workspaces) are left out.
+*/
+static uint64_t mix_double(uint64_t hash, double value){
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return mix_seed(hash, bits);
+}
+
+static uint64_t mix_string(uint64_t hash, const char* text){
+  hash = mix_seed(hash, std::strlen(text));
+  for (; *text; text++) hash = mix_seed(hash, (unsigned char) *text);
+  return hash;
+}
+
+static uint64_t object_key(uint64_t hash, SEXP object){
+  R_xlen_t i, n;
+  hash = mix_seed(hash, TYPEOF(object));
+  switch (TYPEOF(object)){
+  case LGLSXP:
+  case INTSXP:
+    n = Rf_xlength(object);
+    hash = mix_seed(hash, n);
+    for (i = 0; i < n; i++) hash = mix_seed(hash, (uint32_t) INTEGER(object)[i]);
+    break;
+  case REALSXP:
+    n = Rf_xlength(object);
+    hash = mix_seed(hash, n);
+    for (i = 0; i < n; i++) hash = mix_double(hash, REAL(object)[i]);
+    break;
+  case STRSXP:
+    n = Rf_xlength(object);
+    hash = mix_seed(hash, n);
+    for (i = 0; i < n; i++) hash = mix_string(hash, CHAR(STRING_ELT(object, i)));
+    break;
+  case VECSXP:
+    n = Rf_xlength(object);
+    hash = mix_seed(hash, n);
+    for (i = 0; i < n; i++) hash = object_key(hash, VECTOR_ELT(object, i));
+    break;
+  default:
+    return hash;
+  }
+  hash = object_key(hash, Rf_getAttrib(object, R_NamesSymbol));
+  return object_key(hash, Rf_getAttrib(object, R_DimSymbol));
+}
+
+static uint64_t landscape_key(uint64_t hash, const landscape_state& landscape){
+  hash = mix_seed(mix_seed(mix_seed(mix_seed(hash, landscape.nrows), landscape.ncols), landscape.n_stages),
+                  landscape.compact);
+  for (int i = 0; i < landscape.size(); i++) hash = mix_seed(hash, landscape.cells[i]);
+  std::vector<double> population(landscape.population_size());
+  landscape.read_population(population.data());
+  for (size_t i = 0; i < population.size(); i++) hash = mix_double(hash, population[i]);
+  for (std::map<std::string, std::shared_ptr<const habitat_layer> >::const_iterator layer = landscape.layers.begin();
+       layer != landscape.layers.end(); ++layer){
+    hash = mix_string(hash, layer->first.c_str());
+    for (int i = 0; i < layer->second->size(); i++) hash = mix_double(hash, (*layer->second)[i]);
+  }
+  return hash;
+}
+
+static uint64_t scenario_key(const landscape_state& landscape, const List& steps, const List& demography){
+  return object_key(object_key(landscape_key(0, landscape), steps), demography);
+}
+
+/* a simulation whose replicates are run natively: its starting landscape, prepared steps and key */
+struct native_scenario {
+  landscape_state* landscape;
+  std::vector<std::unique_ptr<replicate_step> > steps;
+  uint64_t key;
+};
+
+/* the key of a simulation of one or more scenarios */
+static uint64_t simulation_key(const std::vector<uint64_t>& scenario_keys){
+  uint64_t hash = mix_seed(0, scenario_keys.size());
+  for (size_t s = 0; s < scenario_keys.size(); s++) hash = mix_seed(hash, scenario_keys[s]);
+  return hash;
+}
+
+/*
+** Run replicates of one or more scenarios together, as one pool of
+** (scenario, replicate) runs shared by the worker threads. Replicate r of
+** every scenario draws from streams keyed on (seed, r), so scenarios are
+** compared on common random numbers. Run s * replicates + r is replicate r of
+** scenario s, in the results file, the checkpoint file and in the returned
+** list of runs. With a checkpoint file, each run carries on from its last
+** checkpoint (if it has one), and is checkpointed every checkpoint_every
+** timesteps and when it has finished; the checkpoint file must have been made
+** for the same model (see simulation_key).
+*/
+static List run_replicates(const std::vector<native_scenario>& scenarios, int timesteps, int replicates, double seed,
+                           int n_threads, const IntegerVector& keep, const std::string& path, bool profile,
+                           const std::string& checkpoint = "", int checkpoint_every = 0){
+  int n_runs = scenarios.size() * replicates;
+
+  std::shared_ptr<results_file> file;
+  if (!path.empty()) file = std::make_shared<results_file>(path);
+
+  std::unique_ptr<checkpoint_file> checkpoints;
+  if (!checkpoint.empty()){
+    checkpoints.reset(new checkpoint_file(checkpoint));
+    if (checkpoints->replicates != n_runs || checkpoints->timesteps != timesteps ||
+        checkpoints->keep != std::vector<int>(keep.begin(), keep.end()) || checkpoints->seed != seed){
+      stop("the checkpoint file is not for this simulation");
+    }
+    std::vector<uint64_t> scenario_keys;
+    for (size_t s = 0; s < scenarios.size(); s++) scenario_keys.push_back(scenarios[s].key);
+    if (checkpoints->key != simulation_key(scenario_keys)){
+      stop("the checkpoint file was made for a different model");
+    }
+  }
+  checkpoint_every = std::max(checkpoint_every, 1);
+
+  /* where each timestep's population is kept, if it is */
+  std::vector<int> kept(timesteps, -1);
+  for (int k = 0; k < keep.size(); k++){
+    if (keep[k] >= 1 && keep[k] <= timesteps) kept[keep[k] - 1] = k;
+  }
+
+  /* the results are allocated up front, since worker threads cannot call R */
+  List populations(n_runs);
+  std::vector<double*> kept_populations((size_t) n_runs * keep.size(), (double*) NULL);
+  std::vector<std::unique_ptr<population_summary> > summaries;
+  std::vector<step_profile> profiles;
+  for (int run = 0; run < n_runs; run++){
+    const native_scenario& scenario = scenarios[run / replicates];
+    List replicate(keep.size());
+    for (int t = 0; t < timesteps; t++){
+      if (kept[t] < 0) continue;
+      NumericMatrix population(scenario.landscape->size(), scenario.landscape->n_stages);
+      kept_populations[(size_t) run * keep.size() + kept[t]] = population.begin();
+      replicate[kept[t]] = population;
+    }
+    populations[run] = replicate;
+    summaries.push_back(std::unique_ptr<population_summary>(new population_summary(timesteps, *scenario.landscape,
+                                                                                   file, run)));
+    if (profile) profiles.push_back(step_profile(scenario.steps.size()));
+  }
+
+  bool recorded = true, checkpointed = true;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) num_threads(n_threads) reduction(&&:recorded,checkpointed)
+#endif
+  for (int run = 0; run < n_runs; run++){
+    int thread = 0;
+#ifdef _OPENMP
+    thread = omp_get_thread_num();
+#endif
+    const native_scenario& scenario = scenarios[run / replicates];
+    int n_steps = scenario.steps.size();
+    landscape_state replicate(*scenario.landscape);
+    uint64_t replicate_seed = mix_seed((uint64_t) seed, run % replicates);
+    double* const* run_kept = keep.size() > 0 ? &kept_populations[(size_t) run * keep.size()] : NULL;
+    int started = 0;
+    if (checkpoints){
+#ifdef _OPENMP
+#pragma omp critical(steps_checkpoint_file)
+#endif
+      started = checkpoints->restore(replicate, *summaries[run], run, run_kept);
+      if (started < 0){
+        checkpointed = false;
+        continue;
+      }
+    }
+    if (profile) discard_counts();
+    for (int t = started; t < timesteps; t++){
+      for (int i = 0; i < n_steps; i++){
+        if (profile) profiles[run].start();
+        scenario.steps[i]->run(replicate, mix_seed(replicate_seed, (uint64_t) t * n_steps + i), thread);
+        if (profile) profiles[run].stop(i);
+      }
+      recorded = summaries[run]->record(replicate, t) && recorded;
+      if (kept[t] >= 0){
+        replicate.read_population(kept_populations[(size_t) run * keep.size() + kept[t]]);
+      }
+      if (checkpoints && ((t + 1) % checkpoint_every == 0 || t + 1 == timesteps)){
+        bool saved;
+#ifdef _OPENMP
+#pragma omp critical(steps_checkpoint_file)
+#endif
+        saved = checkpoints->save(replicate, *summaries[run], run, t + 1, run_kept, started);
+        checkpointed = saved && checkpointed;
+        started = t + 1;
+      }
+    }
+  }
+
+  if (!recorded) stop("the population could not be written to the results file");
+  if (!checkpointed) stop("the replicates could not be checkpointed, or carried on from the checkpoint file");
+
+  List results(n_runs);
+  for (int run = 0; run < n_runs; run++){
+    results[run] = List::create(Named("populations") = populations[run],
+                                Named("summary") = summary_results(*summaries[run]),
+                                Named("profile") = profile ? (SEXP) profiles[run].results() : R_NilValue);
+  }
+  return results;
+}
+
+// //' run replicate simulations of built-in dynamics on worker threads.
+// //' @param steps the native steps of the dynamics, as for rcpp_simulate.
+// //' @param seed seeds the replicates' random streams: replicate r draws from streams keyed on (seed, r) whichever thread runs it, so results do not depend on the number of threads.
+// //' @param keep the (one-based) timesteps at which to keep the population of each replicate.
+// //' @param path a results file (created by rcpp_results_file) to write the population to at every timestep, or "" for none.
+// //' @param profile should the replicates be profiled?
+// //' @param cache a directory to keep what barrier paths find in (see dispersal_artifacts), or "" for none.
+// //' @param checkpoint a checkpoint file (created by rcpp_checkpoint_file for this seed) to carry on from and checkpoint the replicates to, or "" for none.
+// //' @param checkpoint_every how many timesteps to run between checkpoints.
+// //' @return for each replicate, a list of the cells x stages populations at the kept timesteps, the summaries of rcpp_summary_results and, if profiling, its profile (as from rcpp_simulate).
+// [[Rcpp::export]]
+List rcpp_simulate_replicates(List steps, int timesteps, SEXP landscape, List demography, int replicates,
+                              double seed, int n_threads = 1, IntegerVector keep = IntegerVector(0),
+                              std::string path = "", bool profile = false, std::string cache = "",
+                              std::string checkpoint = "", int checkpoint_every = 10){
+  n_threads = std::max(n_threads, 1);
+  std::shared_ptr<dispersal_artifacts> artifacts = shared_dispersal_artifacts(cache);
+  std::vector<native_scenario> scenarios(1);
+  scenarios[0].landscape = landscape_pointer(landscape);
+  scenarios[0].steps = prepare_steps(*scenarios[0].landscape, steps, demography, n_threads, artifacts.get());
+  if (!checkpoint.empty()) scenarios[0].key = scenario_key(*scenarios[0].landscape, steps, demography);
+  List results = run_replicates(scenarios, timesteps, replicates, seed, n_threads, keep, path, profile,
+                                checkpoint, checkpoint_every);
+  if (!save_dispersal_artifacts(*artifacts)) warning("the barrier paths could not be saved to the cache");
+  return results;
+}
+
+// //' run replicate simulations of several scenarios of built-in dynamics on one pool of worker threads.
+// //' @param scenarios for each scenario, a list of its native steps (as for rcpp_simulate), landscape state and demography. Stencils, barrier paths, landscape maps and scratch buffers are shared by the scenarios' dispersal steps wherever they can be.
+// //' @param seed seeds the replicates' random streams: replicate r of every scenario draws from streams keyed on (seed, r).
+// //' @param path a results file (created by rcpp_results_file for scenarios x replicates replicates) to write the population to at every timestep, with replicate r of scenario s as its replicate s * replicates + r (zero-based), or "" for none.
+// //' @param cache,checkpoint,checkpoint_every as for rcpp_simulate_replicates, with the checkpoint file created for scenarios x replicates replicates.
+// //' @return for each scenario, a list of its replicates' results (as from rcpp_simulate_replicates).
+// [[Rcpp::export]]
+List rcpp_simulate_sweep(List scenarios, int timesteps, int replicates, double seed, int n_threads = 1,
+                         IntegerVector keep = IntegerVector(0), std::string path = "", std::string cache = "",
+                         std::string checkpoint = "", int checkpoint_every = 10){
+  n_threads = std::max(n_threads, 1);
+  int n_scenarios = scenarios.size();
+  std::shared_ptr<dispersal_artifacts> artifacts = shared_dispersal_artifacts(cache);
+  std::vector<native_scenario> prepared(n_scenarios);
+  for (int s = 0; s < n_scenarios; s++){
+    List scenario = scenarios[s];
+    prepared[s].landscape = landscape_pointer(scenario["landscape"]);
+    prepared[s].steps = prepare_steps(*prepared[s].landscape, scenario["steps"], scenario["demography"], n_threads,
+                                      artifacts.get());
+    if (!checkpoint.empty()) prepared[s].key = scenario_key(*prepared[s].landscape, scenario["steps"], scenario["demography"]);
+  }
+
+  List runs = run_replicates(prepared, timesteps, replicates, seed, n_threads, keep, path, false,
+                             checkpoint, checkpoint_every);
+  if (!save_dispersal_artifacts(*artifacts)) warning("the barrier paths could not be saved to the cache");
+
+  List results(n_scenarios);
+  for (int s = 0; s < n_scenarios; s++){
+    List scenario_runs(replicates);
+    for (int r = 0; r < replicates; r++) scenario_runs[r] = runs[s * replicates + r];
+    results[s] = scenario_runs;
+  }
+  return results;
+}
+
+// //' the key of the model simulated by one or more scenarios (each a list of native steps, landscape state and demography, as for rcpp_simulate_sweep), which a checkpoint file is made for (see rcpp_checkpoint_file).
+// [[Rcpp::export]]
+std::string rcpp_simulation_key(List scenarios){
+  std::vector<uint64_t> scenario_keys;
+  for (int s = 0; s < scenarios.size(); s++){
+    List scenario = scenarios[s];
+    scenario_keys.push_back(scenario_key(*landscape_pointer(scenario["landscape"]), scenario["steps"],
+                                         scenario["demography"]));
+  }
+  return checkpoint_file::key_text(simulation_key(scenario_keys));
+}
@@ -0,0 +1,114 @@
+#include <Rcpp.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include "landscape_state.h"
+#include "simulation_results.h"
+using namespace Rcpp;
+
+/*
+** Summaries, results files and checkpoint files for simulations (see
+** simulation_results.h), used by iterate_system() and rcpp_simulate_replicates.
+*/
+
+/* the summaries as an R list */
+List summary_results(const population_summary& summary){
+  int n_cells = summary.cell_mean.size();
+  NumericMatrix totals(summary.timesteps, summary.n_stages);
+  NumericVector cell_mean(n_cells), cell_variance(n_cells);
+  std::copy(summary.totals.begin(), summary.totals.end(), totals.begin());
+  for (int i = 0; i < n_cells; i++){
+    cell_mean[i] = summary.n_recorded > 0 ? summary.cell_mean[i] : NA_REAL;
+    cell_variance[i] = summary.cell_variance(i);
+  }
+  return List::create(Named("population_totals") = totals,
+                      Named("occupancy") = NumericVector(summary.occupancy.begin(), summary.occupancy.end()),
+                      Named("cell_mean") = cell_mean,
+                      Named("cell_variance") = cell_variance);
+}
+
+// //' create a results file for replicates of a landscape state (replacing any existing file).
+// [[Rcpp::export]]
+void rcpp_results_file(std::string path, int replicates, int timesteps, SEXP landscape){
+  results_file::create(path, replicates, timesteps, *landscape_pointer(landscape));
+}
+
+// //' the layout of a results file: its replicates, timesteps, landscape dimensions, stages and (one-based) cell numbers.
+// [[Rcpp::export]]
+List rcpp_results_header(std::string path){
+  results_file file(path);
+  return List::create(Named("replicates") = file.replicates,
+                      Named("timesteps") = file.timesteps,
+                      Named("dim") = IntegerVector::create(file.nrows, file.ncols),
+                      Named("stages") = file.n_stages,
+                      Named("cells") = IntegerVector(file.cells.begin(), file.cells.end()));
+}
+
+// //' read the cells x stages population of a (one-based) replicate and timestep from a results file.
+// [[Rcpp::export]]
+NumericMatrix rcpp_results_population(std::string path, int replicate, int timestep){
+  results_file file(path);
+  NumericMatrix population(file.cells.size(), file.n_stages);
+  file.read(replicate - 1, timestep - 1, population.begin());
+  return population;
+}
+
+// //' create a checkpoint file for replicates of a landscape state (replacing any existing file), with none started.
+// //' @param keep the (one-based) timesteps at which the population of each replicate is kept.
+// //' @param seed the seed of the replicates' random streams, kept so that the simulation can be carried on.
+// //' @param key the key of the simulated model, from rcpp_simulation_key.
+// [[Rcpp::export]]
+void rcpp_checkpoint_file(std::string path, int replicates, int timesteps, SEXP landscape, IntegerVector keep, double seed,
+                          std::string key){
+  checkpoint_file::create(path, replicates, timesteps, *landscape_pointer(landscape),
+                          std::vector<int>(keep.begin(), keep.end()), seed, checkpoint_file::parse_key(key));
+}
+
+// //' the simulation a checkpoint file is for: its replicates, timesteps, cells, stages, kept timesteps, seed and model key, and the timesteps each replicate had completed at its last checkpoint.
+// [[Rcpp::export]]
+List rcpp_checkpoint_header(std::string path){
+  checkpoint_file file(path);
+  IntegerVector completed(file.replicates);
+  for (int r = 0; r < file.replicates; r++) completed[r] = file.completed(r);
+  return List::create(Named("replicates") = file.replicates,
+                      Named("timesteps") = file.timesteps,
+                      Named("cells") = file.n_cells,
+                      Named("stages") = file.n_stages,
+                      Named("keep") = IntegerVector(file.keep.begin(), file.keep.end()),
+                      Named("seed") = file.seed,
+                      Named("key") = checkpoint_file::key_text(file.key),
+                      Named("completed") = completed);
+}
+
+// //' drop the last checkpoint of a (one-based) replicate in a checkpoint file, as if it had been cut short, so that the replicate carries on from the checkpoint before it.
+// [[Rcpp::export]]
+void rcpp_checkpoint_discard(std::string path, int replicate){
+  checkpoint_file file(path);
+  if (!file.discard(replicate - 1)) stop("can't discard the last checkpoint of replicate %d", replicate);
+}
+
+// //' create a summary of a replicate of a landscape state over a number of timesteps.
+// //' @param path a results file to write the population to at each timestep (created by rcpp_results_file), or "" for none.
+// //' @param replicate the (one-based) replicate in the results file.
+// [[Rcpp::export]]
+SEXP rcpp_population_summary(SEXP landscape, int timesteps, std::string path = "", int replicate = 1){
+  std::shared_ptr<results_file> file;
+  if (!path.empty()) file = std::make_shared<results_file>(path);
+  XPtr<population_summary> summary(new population_summary(timesteps, *landscape_pointer(landscape), file, replicate - 1),
+                                   true);
+  return summary;
+}
+
+// //' summarise the population of a landscape state at a (one-based) timestep.
+// [[Rcpp::export]]
+void rcpp_summary_record(SEXP summary, SEXP landscape, int timestep){
+  if (!summary_pointer(summary)->record(*landscape_pointer(landscape), timestep - 1)){
+    stop("the population could not be summarised or written to the results file");
+  }
+}
+
+// //' the per-stage totals and occupancy at each timestep, and per-cell mean and variance, of a summary.
+// [[Rcpp::export]]
+List rcpp_summary_results(SEXP summary){
+  return summary_results(*summary_pointer(summary));
+}
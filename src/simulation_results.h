@@ -0,0 +1,471 @@
+#ifndef STEPS_SIMULATION_RESULTS_H
+#define STEPS_SIMULATION_RESULTS_H
+
+#include <Rcpp.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include "landscape_state.h"
+
+/*
+** Results of a simulation that are kept as it runs, instead of (or as well as)
+** the full state at every timestep.
+**
+** results_file: the population of every replicate at every timestep, written
+**            to a binary file as the simulation runs. The file is a header
+**
+**              char[8]  "STEPSRES"
+**              int32    version (1), replicates, timesteps, nrows, ncols,
+**                       stages, cells
+**              int32    the (one-based) raster cell numbers of the cells
+**
+**            followed by a chunk for each replicate and timestep (replicates
+**            outermost), holding the cells x stages population as doubles,
+**            all in native byte order. Chunks have fixed offsets, so they can
+**            be written in any order (by threads or processes), and read (or
+**            memory-mapped) one at a time.
+*/
+class results_file {
+public:
+  int replicates;
+  int timesteps;
+  int nrows;
+  int ncols;
+  int n_stages;
+  std::vector<int> cells;
+
+  /* open an existing results file for reading and writing chunks */
+  explicit results_file(const std::string& path) : file(std::fopen(path.c_str(), "r+b")) {
+    if (file == NULL) Rcpp::stop("can't open the results file '" + path + "'");
+    char magic[8];
+    int32_t header[7];
+    if (std::fread(magic, 1, 8, file) != 8 || std::string(magic, 8) != "STEPSRES" ||
+        std::fread(header, sizeof(int32_t), 7, file) != 7 || header[0] != 1){
+      std::fclose(file);
+      Rcpp::stop("'" + path + "' is not a steps results file");
+    }
+    replicates = header[1];
+    timesteps = header[2];
+    nrows = header[3];
+    ncols = header[4];
+    n_stages = header[5];
+    cells.resize(header[6]);
+    if (std::fread(cells.data(), sizeof(int32_t), cells.size(), file) != cells.size()){
+      std::fclose(file);
+      Rcpp::stop("the results file '" + path + "' is incomplete");
+    }
+    data_offset = 8 + sizeof(int32_t) * (7 + cells.size());
+  }
+
+  ~results_file(){ std::fclose(file); }
+
+  /* create a results file (replacing any existing one) for replicates of a landscape */
+  static void create(const std::string& path, int replicates, int timesteps, const landscape_state& landscape){
+    FILE* created = std::fopen(path.c_str(), "wb");
+    if (created == NULL) Rcpp::stop("can't create the results file '" + path + "'");
+    int32_t header[7] = {1, replicates, timesteps, landscape.nrows, landscape.ncols,
+                         landscape.n_stages, (int32_t) landscape.size()};
+    std::vector<int32_t> cell_numbers(landscape.cells.begin(), landscape.cells.end());
+    for (size_t i = 0; i < cell_numbers.size(); i++) cell_numbers[i]++;
+    bool written = std::fwrite("STEPSRES", 1, 8, created) == 8 &&
+      std::fwrite(header, sizeof(int32_t), 7, created) == 7 &&
+      std::fwrite(cell_numbers.data(), sizeof(int32_t), cell_numbers.size(), created) == cell_numbers.size();
+    if (std::fclose(created) != 0 || !written) Rcpp::stop("can't write the results file '" + path + "'");
+  }
+
+  /* write the population of a replicate at a (zero-based) timestep; returns false on failure */
+  bool write(const landscape_state& landscape, int replicate, int timestep){
+    if (!matches(landscape, replicate, timestep)) return false;
+    size_t n = landscape.population_size();
+    const double* population = landscape.population.data();
+    std::vector<double> expanded;
+    if (landscape.compact){
+      expanded.resize(n);
+      landscape.read_population(expanded.data());
+      population = expanded.data();
+    }
+    return seek(chunk_offset(replicate, timestep)) &&
+      std::fwrite(population, sizeof(double), n, file) == n &&
+      std::fflush(file) == 0;
+  }
+
+  /* read the population of a replicate at a (zero-based) timestep into a cells x stages array */
+  void read(int replicate, int timestep, double* population){
+    if (replicate < 0 || replicate >= replicates || timestep < 0 || timestep >= timesteps){
+      Rcpp::stop("the results file has no such replicate or timestep");
+    }
+    size_t n = cells.size() * n_stages;
+    if (!seek(chunk_offset(replicate, timestep)) || std::fread(population, sizeof(double), n, file) != n){
+      Rcpp::stop("the results file has not been written for this replicate and timestep");
+    }
+  }
+
+private:
+  FILE* file;
+  int64_t data_offset;
+
+  results_file(const results_file&);
+  results_file& operator=(const results_file&);
+
+  bool matches(const landscape_state& landscape, int replicate, int timestep) const {
+    return replicate >= 0 && replicate < replicates && timestep >= 0 && timestep < timesteps &&
+      landscape.n_stages == n_stages && landscape.size() == (int) cells.size();
+  }
+
+  int64_t chunk_offset(int replicate, int timestep) const {
+    return data_offset + ((int64_t) replicate * timesteps + timestep) * (int64_t) cells.size() * n_stages * sizeof(double);
+  }
+
+  bool seek(int64_t offset){
+#ifdef _WIN32
+    return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t) offset, SEEK_SET) == 0;
+#endif
+  }
+};
+
+/*
+** population_summary: summaries of one replicate, updated at the end of each
+**            timestep: the total population of each stage and the number of
+**            occupied cells (with a total population above zero) at each
+**            timestep, and the mean and variance over timesteps of the total
+**            population of each cell (by Welford's method). If it has a
+**            results file, the population is also written there.
+*/
+class population_summary {
+public:
+  int timesteps;
+  int n_stages;
+  std::vector<double> totals;     // timesteps x stages
+  std::vector<double> occupancy;  // per timestep
+  std::vector<double> cell_mean;  // per cell
+  std::vector<double> cell_m2;    // per cell, sum of squared deviations from the mean
+  int n_recorded;
+
+  population_summary(int timesteps, const landscape_state& landscape,
+                     std::shared_ptr<results_file> file = std::shared_ptr<results_file>(), int replicate = 0) :
+    timesteps(timesteps), n_stages(landscape.n_stages),
+    totals((size_t) timesteps * landscape.n_stages, NA_REAL), occupancy(timesteps, NA_REAL),
+    cell_mean(landscape.size(), 0.0), cell_m2(landscape.size(), 0.0), n_recorded(0),
+    file(file), replicate(replicate) {}
+
+  /* summarise the population at a (zero-based) timestep; returns false if it couldn't be written to the results file */
+  bool record(landscape_state& landscape, int timestep){
+    int n_cells = landscape.size(), i, s;
+    if (timestep < 0 || timestep >= timesteps || landscape.n_stages != n_stages || n_cells != (int) cell_mean.size()){
+      return false;
+    }
+
+    std::vector<double> cell_total(n_cells, 0.0), buffer;
+    for (s = 0; s < n_stages; s++){
+      const double* population = landscape.stage_values(s, buffer);
+      long double total = 0.0;
+      for (i = 0; i < n_cells; i++){
+        total += population[i];
+        cell_total[i] += population[i];
+      }
+      totals[timestep + (size_t) s * timesteps] = (double) total;
+    }
+
+    int occupied = 0;
+    n_recorded++;
+    for (i = 0; i < n_cells; i++){
+      if (cell_total[i] > 0) occupied++;
+      double delta = cell_total[i] - cell_mean[i];
+      cell_mean[i] += delta / n_recorded;
+      cell_m2[i] += delta * (cell_total[i] - cell_mean[i]);
+    }
+    occupancy[timestep] = occupied;
+
+    if (!file) return true;
+    bool written;
+#ifdef _OPENMP
+#pragma omp critical(steps_results_file)
+#endif
+    written = file->write(landscape, replicate, timestep);
+    return written;
+  }
+
+  double cell_variance(int i) const {
+    return n_recorded > 1 ? cell_m2[i] / (n_recorded - 1) : NA_REAL;
+  }
+
+private:
+  std::shared_ptr<results_file> file;
+  int replicate;
+};
+
+/*
+** checkpoint_file: the state of every replicate of a simulation run natively
+**            (see rcpp_simulate_replicates), saved every so many timesteps so
+**            that a simulation that is stopped can carry on from the last
+**            timestep each replicate saved. Native random streams are keyed on
+**            the simulation's seed, the replicate and the timestep, so the
+**            state of a replicate is just its population, its density
+**            dependence multipliers and its summaries. The file is a header
+**
+**              char[8]  "STEPSCKP"
+**              int32    version (2), replicates, timesteps, cells, stages,
+**                       kept timesteps
+**              double   the simulation's seed
+**              uint64   the key of the simulated model (see simulation_key
+**                       in simulation_driver.cpp)
+**              int32    the (one-based) kept timesteps
+**
+**            followed, for each replicate, by two slots and its kept
+**            populations. A slot holds
+**
+**              int32    the timesteps completed (0 if none), whether there
+**                       are multipliers, the timesteps recorded, and 0
+**              double   the cells x stages population, the fecundity and
+**                       survival multipliers of each cell, the summary's
+**                       totals and occupancy, and each cell's mean and sum of
+**                       squared deviations
+**
+**            and a kept population is cells x stages doubles, all in native
+**            byte order. Each checkpoint of a replicate replaces its older
+**            slot, with the timesteps completed written last, so that a
+**            checkpoint cut short leaves the one before it to carry on from.
+*/
+class checkpoint_file {
+public:
+  /* keys are passed to and from R as 16 hexadecimal digits */
+  static std::string key_text(uint64_t key){
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", (unsigned long long) key);
+    return text;
+  }
+
+  static uint64_t parse_key(const std::string& text){
+    return std::strtoull(text.c_str(), NULL, 16);
+  }
+
+  int replicates;
+  int timesteps;
+  int n_cells;
+  int n_stages;
+  double seed;
+  uint64_t key;
+  std::vector<int> keep;
+
+  /* open an existing checkpoint file for reading and writing replicates */
+  explicit checkpoint_file(const std::string& path) : file(std::fopen(path.c_str(), "r+b")) {
+    if (file == NULL) Rcpp::stop("can't open the checkpoint file '" + path + "'");
+    char magic[8];
+    int32_t header[6];
+    if (std::fread(magic, 1, 8, file) != 8 || std::string(magic, 8) != "STEPSCKP" ||
+        std::fread(header, sizeof(int32_t), 6, file) != 6 || header[0] != 2 ||
+        std::fread(&seed, sizeof(double), 1, file) != 1 || std::fread(&key, sizeof(uint64_t), 1, file) != 1){
+      std::fclose(file);
+      Rcpp::stop("'" + path + "' is not a steps checkpoint file");
+    }
+    replicates = header[1];
+    timesteps = header[2];
+    n_cells = header[3];
+    n_stages = header[4];
+    keep.resize(header[5]);
+    if (std::fread(keep.data(), sizeof(int32_t), keep.size(), file) != keep.size()){
+      std::fclose(file);
+      Rcpp::stop("the checkpoint file '" + path + "' is incomplete");
+    }
+    data_offset = header_bytes(keep.size());
+  }
+
+  ~checkpoint_file(){ std::fclose(file); }
+
+  /* create a checkpoint file (replacing any existing one), with no replicate started */
+  static void create(const std::string& path, int replicates, int timesteps, const landscape_state& landscape,
+                     const std::vector<int>& keep, double seed, uint64_t key){
+    FILE* created = std::fopen(path.c_str(), "wb");
+    if (created == NULL) Rcpp::stop("can't create the checkpoint file '" + path + "'");
+    int32_t header[6] = {2, replicates, timesteps, (int32_t) landscape.size(), landscape.n_stages, (int32_t) keep.size()};
+    std::vector<int32_t> kept(keep.begin(), keep.end());
+    bool written = std::fwrite("STEPSCKP", 1, 8, created) == 8 &&
+      std::fwrite(header, sizeof(int32_t), 6, created) == 6 &&
+      std::fwrite(&seed, sizeof(double), 1, created) == 1 &&
+      std::fwrite(&key, sizeof(uint64_t), 1, created) == 1 &&
+      std::fwrite(kept.data(), sizeof(int32_t), kept.size(), created) == kept.size();
+    /* every slot starts with no timesteps completed */
+    int32_t empty[4] = {0, 0, 0, 0};
+    int64_t offset = header_bytes(kept.size());
+    for (int r = 0; written && r < replicates; r++){
+      for (int slot = 0; written && slot < 2; slot++){
+        written = seek(created, offset + r * replicate_bytes(landscape.size(), landscape.n_stages, timesteps, keep.size()) +
+                       slot * slot_bytes(landscape.size(), landscape.n_stages, timesteps)) &&
+          std::fwrite(empty, sizeof(int32_t), 4, created) == 4;
+      }
+    }
+    if (std::fclose(created) != 0 || !written) Rcpp::stop("can't write the checkpoint file '" + path + "'");
+  }
+
+  /*
+  ** Restore a replicate from its last checkpoint: its population, multipliers
+  ** and summary, and its populations at the kept timesteps it had completed
+  ** (into kept, one per kept timestep). Returns the timesteps it had
+  ** completed, 0 (leaving everything as it was) if it has no checkpoint, or
+  ** -1 if its checkpoint can't be read.
+  */
+  int restore(landscape_state& landscape, population_summary& summary, int replicate, double* const* kept){
+    if (!matches(landscape, summary, replicate)) return -1;
+    int32_t header[2][4];
+    int slot = last_slot(replicate, header);
+    if (slot < 0) return 0;
+    int completed = header[slot][0];
+    size_t n = landscape.population_size(), cells = n_cells;
+    std::vector<double> population(n), fecundity(cells), survival(cells);
+    bool read = seek(file, slot_offset(replicate, slot) + 4 * sizeof(int32_t)) &&
+      std::fread(population.data(), sizeof(double), n, file) == n &&
+      std::fread(fecundity.data(), sizeof(double), cells, file) == cells &&
+      std::fread(survival.data(), sizeof(double), cells, file) == cells &&
+      std::fread(summary.totals.data(), sizeof(double), summary.totals.size(), file) == summary.totals.size() &&
+      std::fread(summary.occupancy.data(), sizeof(double), summary.occupancy.size(), file) == summary.occupancy.size() &&
+      std::fread(summary.cell_mean.data(), sizeof(double), cells, file) == cells &&
+      std::fread(summary.cell_m2.data(), sizeof(double), cells, file) == cells;
+    for (size_t k = 0; read && k < keep.size(); k++){
+      if (keep[k] > completed) continue;
+      read = seek(file, kept_offset(replicate, k)) && std::fread(kept[k], sizeof(double), n, file) == n;
+    }
+    if (!read) return -1;
+    landscape.write_population(population.data());
+    if (header[slot][1]){
+      landscape.fecundity_scale.swap(fecundity);
+      landscape.survival_scale.swap(survival);
+    } else {
+      landscape.fecundity_scale.clear();
+      landscape.survival_scale.clear();
+    }
+    summary.n_recorded = header[slot][2];
+    return completed;
+  }
+
+  /*
+  ** Save a replicate that has completed some timesteps, with its populations
+  ** at the kept timesteps completed since the last checkpoint (at since);
+  ** returns false on failure.
+  */
+  bool save(const landscape_state& landscape, const population_summary& summary, int replicate, int completed,
+            const double* const* kept, int since){
+    if (!matches(landscape, summary, replicate) || completed < 1 || completed > timesteps) return false;
+    int32_t header[2][4];
+    int last = last_slot(replicate, header);
+    int slot = (last == 0) ? 1 : 0;
+    size_t n = landscape.population_size(), cells = n_cells;
+    std::vector<double> population(n);
+    landscape.read_population(population.data());
+    bool scaled = !landscape.fecundity_scale.empty();
+    std::vector<double> no_scale(scaled ? 0 : cells, 1.0);
+    const double* fecundity = scaled ? landscape.fecundity_scale.data() : no_scale.data();
+    const double* survival = scaled ? landscape.survival_scale.data() : no_scale.data();
+
+    bool written = true;
+    for (size_t k = 0; written && k < keep.size(); k++){
+      if (keep[k] <= since || keep[k] > completed) continue;
+      written = seek(file, kept_offset(replicate, k)) && std::fwrite(kept[k], sizeof(double), n, file) == n;
+    }
+    written = written && seek(file, slot_offset(replicate, slot) + 4 * sizeof(int32_t)) &&
+      std::fwrite(population.data(), sizeof(double), n, file) == n &&
+      std::fwrite(fecundity, sizeof(double), cells, file) == cells &&
+      std::fwrite(survival, sizeof(double), cells, file) == cells &&
+      std::fwrite(summary.totals.data(), sizeof(double), summary.totals.size(), file) == summary.totals.size() &&
+      std::fwrite(summary.occupancy.data(), sizeof(double), summary.occupancy.size(), file) == summary.occupancy.size() &&
+      std::fwrite(summary.cell_mean.data(), sizeof(double), cells, file) == cells &&
+      std::fwrite(summary.cell_m2.data(), sizeof(double), cells, file) == cells &&
+      std::fflush(file) == 0;
+    /* only now is the slot's checkpoint complete */
+    int32_t saved[4] = {completed, scaled, summary.n_recorded, 0};
+    return written && seek(file, slot_offset(replicate, slot)) &&
+      std::fwrite(saved, sizeof(int32_t), 4, file) == 4 &&
+      std::fflush(file) == 0;
+  }
+
+  /* the timesteps a replicate had completed at its last checkpoint (0 if none) */
+  int completed(int replicate){
+    int32_t header[2][4];
+    int slot = (replicate >= 0 && replicate < replicates) ? last_slot(replicate, header) : -1;
+    return slot < 0 ? 0 : header[slot][0];
+  }
+
+  /*
+  ** Drop a replicate's last checkpoint, as if saving it had been cut short, so
+  ** that it carries on from the one before it (if any); returns false on
+  ** failure.
+  */
+  bool discard(int replicate){
+    if (replicate < 0 || replicate >= replicates) return false;
+    int32_t header[2][4];
+    int slot = last_slot(replicate, header);
+    if (slot < 0) return true;
+    int32_t empty[4] = {0, 0, 0, 0};
+    return seek(file, slot_offset(replicate, slot)) && std::fwrite(empty, sizeof(int32_t), 4, file) == 4 &&
+      std::fflush(file) == 0;
+  }
+
+private:
+  FILE* file;
+  int64_t data_offset;
+
+  checkpoint_file(const checkpoint_file&);
+  checkpoint_file& operator=(const checkpoint_file&);
+
+  bool matches(const landscape_state& landscape, const population_summary& summary, int replicate) const {
+    return replicate >= 0 && replicate < replicates && landscape.n_stages == n_stages && landscape.size() == n_cells &&
+      summary.timesteps == timesteps && summary.n_stages == n_stages;
+  }
+
+  /* the slot (0 or 1) with the most timesteps completed, reading both slots' headers; -1 if neither has any */
+  int last_slot(int replicate, int32_t header[2][4]){
+    for (int slot = 0; slot < 2; slot++){
+      if (!seek(file, slot_offset(replicate, slot)) || std::fread(header[slot], sizeof(int32_t), 4, file) != 4){
+        header[slot][0] = 0;
+      }
+    }
+    if (header[0][0] == 0 && header[1][0] == 0) return -1;
+    return header[1][0] > header[0][0] ? 1 : 0;
+  }
+
+  static int64_t header_bytes(int n_kept){
+    return 8 + sizeof(int32_t) * (6 + (int64_t) n_kept) + sizeof(double) + sizeof(uint64_t);
+  }
+
+  static int64_t slot_bytes(int cells, int stages, int timesteps){
+    return 4 * sizeof(int32_t) +
+      ((int64_t) cells * stages + 4 * (int64_t) cells + (int64_t) timesteps * stages + timesteps) * sizeof(double);
+  }
+
+  static int64_t replicate_bytes(int cells, int stages, int timesteps, int n_kept){
+    return 2 * slot_bytes(cells, stages, timesteps) + (int64_t) n_kept * cells * stages * sizeof(double);
+  }
+
+  int64_t slot_offset(int replicate, int slot) const {
+    return data_offset + replicate * replicate_bytes(n_cells, n_stages, timesteps, keep.size()) +
+      slot * slot_bytes(n_cells, n_stages, timesteps);
+  }
+
+  int64_t kept_offset(int replicate, int k) const {
+    return slot_offset(replicate, 2) + (int64_t) k * n_cells * n_stages * sizeof(double);
+  }
+
+  static bool seek(FILE* file, int64_t offset){
+#ifdef _WIN32
+    return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t) offset, SEEK_SET) == 0;
+#endif
+  }
+};
+
+/* the summary behind an external pointer */
+inline population_summary* summary_pointer(SEXP summary){
+  if (TYPEOF(summary) != EXTPTRSXP || R_ExternalPtrAddr(summary) == NULL){
+    Rcpp::stop("the population summary is no longer valid");
+  }
+  return Rcpp::XPtr<population_summary>(summary).get();
+}
+
+Rcpp::List summary_results(const population_summary& summary);
+
+#endif
@@ -0,0 +1,291 @@
+#include <Rcpp.h>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include "random_streams.h"
+#include "landscape_state.h"
+using namespace Rcpp;
+
+/*
+** Stage-based population change for every (non-NA) cell of a landscape.
+**
+** Populations are held as a cells x stages matrix (each stage contiguous), and
+** transition matrices as in the demography object (see transition_matrices in
+** landscape_state.h): compact local matrices are expanded one cell at a time.
+**
+** The projections are templated on the number of stages (0 means it is only
+** known at run time) so that for the common, small stage counts the loops over
+** stages have fixed bounds and the compiler can unroll them.
+**
+** Density dependence in the demography (see landscape_state) is applied to each
+** cell's matrix as it is used, so scaled matrices are never stored.
+**
+** The projections are also templated on how the population is held: as
+** doubles, or as the 32-bit counts of a compact landscape, which are read and
+** written cell by cell so that a compact population is never copied into
+** double precision.
+*/
+
+inline double population_value(double value){ return value; }
+inline double population_value(int32_t count){ return expand_count(count); }
+
+inline void store_population(double& to, double value){ to = value; }
+inline void store_population(int32_t& to, double value){ to = compact_count(value); }
+
+inline void add_population(double& to, double value){ to += value; }
+inline void add_population(int32_t& to, double value){ to = compact_count(expand_count(to) + value); }
+
+/* the whole individuals in a population value: as stats::rmultinom, partial
+** individuals are dropped, and missing values hold none */
+inline double whole_individuals(double value){ return ISNAN(value) || !(value > 0) ? 0.0 : std::floor(value); }
+
+/* per-cell multipliers of fecundity (above the diagonal) and survival (on and below it), or none */
+struct transition_scale {
+  const double* fecundity;
+  const double* survival;
+
+  transition_scale() : fecundity(NULL), survival(NULL) {}
+  explicit transition_scale(const landscape_state& landscape) :
+    fecundity(landscape.fecundity_scale.empty() ? NULL : landscape.fecundity_scale.data()),
+    survival(landscape.survival_scale.empty() ? NULL : landscape.survival_scale.data()) {}
+
+  bool any() const { return fecundity != NULL && survival != NULL; }
+};
+
+/* The transition matrix of cell i (local if matrix_index isn't NULL), expanded and scaled into scaled if need be. */
+template <int S>
+inline const double* cell_matrix(const transition_matrices& transitions, const int* matrix_index,
+                                 const transition_scale& scale, int i, int n_stages, double* scaled){
+  const int n = S > 0 ? S : n_stages;
+  const double* matrix = transitions.matrix(matrix_index != NULL ? matrix_index[i] : 0, n, scaled);
+  if (!scale.any()) return matrix;
+  for (int k = 0; k < n; k++){
+    for (int j = 0; j < n; j++) scaled[j + k * n] = matrix[j + k * n] * (j < k ? scale.fecundity[i] : scale.survival[i]);
+  }
+  return scaled;
+}
+
+/* Deterministic change with one transition matrix for all cells: each stage is projected over all cells in turn. */
+template <int S, class In, class Out>
+void project_global(const In* population, const double* transition, int n_cells, int n_stages, Out* projected){
+  const int n = S > 0 ? S : n_stages;
+  int i, j, k;
+  for (j = 0; j < n; j++){
+    Out* to = projected + (size_t) j * n_cells;
+    for (i = 0; i < n_cells; i++){
+      double value = 0.0;
+      for (k = 0; k < n; k++) value += transition[j + k * n] * population_value(population[i + (size_t) k * n_cells]);
+      store_population(to[i], value);
+    }
+  }
+}
+
+/* Deterministic change with a transition matrix per cell (local, or a scaled global one). */
+template <int S, class In, class Out>
+void project_local(const In* population, const transition_matrices& transitions, const int* matrix_index,
+                   const transition_scale& scale, int n_cells, int n_stages, Out* projected){
+  const int n = S > 0 ? S : n_stages;
+  int i, j, k;
+  std::vector<double> scaled(n * n);
+  for (i = 0; i < n_cells; i++){
+    const double* matrix = cell_matrix<S>(transitions, matrix_index, scale, i, n, &scaled[0]);
+    for (j = 0; j < n; j++){
+      double value = 0.0;
+      for (k = 0; k < n; k++) value += matrix[j + k * n] * population_value(population[i + (size_t) k * n_cells]);
+      store_population(projected[i + (size_t) j * n_cells], value);
+    }
+  }
+}
+
+/*
+** Survival probabilities out of stage k, as drawn by the multinomial: a zero
+** for the first (newborn) stage, the survival rates into the other stages and,
+** last, the probability of dying.
+*/
+inline void survival_probabilities(const double* matrix, int n, int k, double* prob){
+  long double total = 0.0;
+  prob[0] = 0.0;
+  for (int j = 1; j < n; j++){
+    prob[j] = matrix[j + k * n];
+    total += prob[j];
+  }
+  prob[n] = 1.0 - (double) total;
+  for (int j = 0; j <= n; j++){
+    if (!R_FINITE(prob[j]) || prob[j] < 0) stop("the survival rates out of each stage must sum to at most one");
+  }
+}
+
+/*
+** Stochastic change: survivors out of each stage are redistributed among the
+** stages (or die) with a multinomial draw, and each cell produces a Poisson
+** number of newborns. Draws are made stage by stage, cell by cell, and then
+** newborns cell by cell.
+*/
+template <int S, class RNG, class In, class Out>
+void project_stochastic(RNG& rng, const In* population, const transition_matrices& transitions, const int* matrix_index,
+                        const transition_scale& scale, int n_cells, int n_stages, Out* projected){
+  const int n = S > 0 ? S : n_stages;
+  const bool per_cell = matrix_index != NULL || scale.any();
+  int i, j, k;
+  std::vector<double> prob(n + 1), counts(n + 1), scaled(n * n);
+
+  for (size_t e = 0; e < (size_t) n_cells * n; e++) projected[e] = 0;
+
+  for (k = 0; k < n; k++){
+    if (!per_cell) survival_probabilities(transitions.dense.begin(), n, k, &prob[0]);
+    for (i = 0; i < n_cells; i++){
+      if (per_cell){
+        survival_probabilities(cell_matrix<S>(transitions, matrix_index, scale, i, n, &scaled[0]), n, k, &prob[0]);
+      }
+      double size = whole_individuals(population_value(population[i + (size_t) k * n_cells]));
+      rng_multinom(rng, size, &prob[0], n + 1, &counts[0]);
+      for (j = 1; j < n; j++) add_population(projected[i + (size_t) j * n_cells], counts[j]);
+    }
+  }
+
+  for (i = 0; i < n_cells; i++){
+    const double* matrix = cell_matrix<S>(transitions, matrix_index, scale, i, n, &scaled[0]);
+    double fecundity = 0.0;
+    for (k = 0; k < n; k++){
+      double value = population_value(population[i + (size_t) k * n_cells]);
+      if (!ISNAN(value)) fecundity += matrix[k * n] * value;
+    }
+    add_population(projected[i], rng_pois(rng, fecundity));
+  }
+}
+
+template <int S, class RNG, class In, class Out>
+void project_population(RNG& rng, const In* population, const transition_matrices& transitions,
+                        const int* matrix_index, const transition_scale& scale, int n_cells, int n_stages,
+                        bool demo_stoch, Out* projected){
+  if (demo_stoch){
+    project_stochastic<S>(rng, population, transitions, matrix_index, scale, n_cells, n_stages, projected);
+  } else if (matrix_index != NULL || scale.any()){
+    project_local<S>(population, transitions, matrix_index, scale, n_cells, n_stages, projected);
+  } else {
+    project_global<S>(population, transitions.dense.begin(), n_cells, n_stages, projected);
+  }
+}
+
+/* Check the transition matrices (and matrix indices, if not NULL) for n_stages. */
+static void check_transitions(const transition_matrices& transitions, const int* matrix_index, int n_cells,
+                              int n_stages, bool demo_stoch){
+  transitions.check(n_stages);
+  int n_matrices = transitions.n_matrices(n_stages);
+  std::vector<double> prob(n_stages + 1), expanded(n_stages * n_stages);
+
+  if (n_matrices < 1) stop("there must be at least one transition matrix");
+  if (matrix_index != NULL){
+    for (int i = 0; i < n_cells; i++){
+      if (matrix_index[i] < 0 || matrix_index[i] >= n_matrices) stop("transition matrix index out of range");
+    }
+  }
+  if (demo_stoch){
+    for (int m = 0; m < n_matrices; m++){
+      for (int k = 0; k < n_stages; k++){
+        survival_probabilities(transitions.matrix(m, n_stages, &expanded[0]), n_stages, k, &prob[0]);
+      }
+    }
+  }
+}
+
+/* Project with the specialisation for n_stages; the transitions must have been checked. */
+template <class RNG, class In, class Out>
+static void project_stages(RNG& rng, const In* population, const transition_matrices& rates, const int* matrix_index,
+                           const transition_scale& scale, int n_cells, int n_stages, bool demo_stoch,
+                           Out* projected){
+  switch (n_stages){
+  case 2: project_population<2>(rng, population, rates, matrix_index, scale, n_cells, n_stages, demo_stoch, projected); break;
+  case 3: project_population<3>(rng, population, rates, matrix_index, scale, n_cells, n_stages, demo_stoch, projected); break;
+  case 4: project_population<4>(rng, population, rates, matrix_index, scale, n_cells, n_stages, demo_stoch, projected); break;
+  case 5: project_population<5>(rng, population, rates, matrix_index, scale, n_cells, n_stages, demo_stoch, projected); break;
+  case 6: project_population<6>(rng, population, rates, matrix_index, scale, n_cells, n_stages, demo_stoch, projected); break;
+  case 7: project_population<7>(rng, population, rates, matrix_index, scale, n_cells, n_stages, demo_stoch, projected); break;
+  case 8: project_population<8>(rng, population, rates, matrix_index, scale, n_cells, n_stages, demo_stoch, projected); break;
+  default: project_population<0>(rng, population, rates, matrix_index, scale, n_cells, n_stages, demo_stoch, projected);
+  }
+}
+
+// //' change populations in all cells through their transition matrices.
+// //' @param population a cells x stages matrix of populations.
+// //' @param transition a stages x stages transition matrix, or a stages x stages x n array of transition matrices.
+// //' @param matrix_index for local transition matrices, the (zero-based) matrix used by each cell; empty to use a single global matrix.
+// //' @param demo_stoch should demographic stochasticity be used (multinomial survival and Poisson fecundity)?
+// //' @return the cells x stages matrix of populations after population change.
+// [[Rcpp::export]]
+NumericMatrix rcpp_stage_projection(NumericMatrix population, NumericVector transition,
+                                    IntegerVector matrix_index, bool demo_stoch = false){
+  int n_cells = population.nrow();
+  int n_stages = population.ncol();
+
+  if (matrix_index.size() > 0 && matrix_index.size() != n_cells){
+    stop("there must be one transition matrix index per cell");
+  }
+
+  const int* index = matrix_index.size() > 0 ? matrix_index.begin() : NULL;
+  transition_matrices transitions(transition, index != NULL);
+  check_transitions(transitions, index, n_cells, n_stages, demo_stoch);
+
+  NumericMatrix projected(n_cells, n_stages);
+  r_stream rng;
+  project_stages(rng, population.begin(), transitions, index, transition_scale(), n_cells, n_stages, demo_stoch,
+                 projected.begin());
+  return projected;
+}
+
+/*
+** Project a landscape state in place, applying (and then clearing) its density
+** dependence multipliers. A compact population is projected into new counts,
+** so the projection takes no more than twice the memory of the population in
+** either mode.
+*/
+template <class RNG>
+static void project_landscape(RNG& rng, landscape_state& landscape, const transition_matrices& transitions,
+                              bool demo_stoch){
+  const int* matrix_index = transitions.local ? landscape.cells.data() : NULL;
+  if (landscape.compact){
+    std::vector<int32_t> projected(landscape.population_size());
+    project_stages(rng, landscape.counts.data(), transitions, matrix_index, transition_scale(landscape),
+                   landscape.size(), landscape.n_stages, demo_stoch, projected.data());
+    landscape.counts.swap(projected);
+  } else {
+    std::vector<double> projected(landscape.population_size());
+    project_stages(rng, landscape.population.data(), transitions, matrix_index, transition_scale(landscape),
+                   landscape.size(), landscape.n_stages, demo_stoch, projected.data());
+    landscape.population.swap(projected);
+  }
+  landscape.fecundity_scale.clear();
+  landscape.survival_scale.clear();
+}
+
+/* Population change of a landscape state in place; local transition matrices have a matrix for every raster cell. */
+void landscape_stage_projection(landscape_state& landscape, const transition_matrices& transitions, bool demo_stoch){
+  check_transitions(transitions, transitions.local ? landscape.cells.data() : NULL, landscape.size(),
+                    landscape.n_stages, demo_stoch);
+  r_stream rng;
+  project_landscape(rng, landscape, transitions, demo_stoch);
+}
+
+/* Population change for replicates: the transition matrices are checked once, and drawn from with counter streams. */
+class replicate_projection : public replicate_step {
+public:
+  replicate_projection(const landscape_state& landscape, const transition_matrices& transitions, bool demo_stoch) :
+    transitions(transitions), demo_stoch(demo_stoch) {
+    check_transitions(transitions, transitions.local ? landscape.cells.data() : NULL, landscape.size(),
+                      landscape.n_stages, demo_stoch);
+  }
+
+  void run(landscape_state& landscape, uint64_t seed, int){
+    counter_stream rng(seed, 0, 0);
+    project_landscape(rng, landscape, transitions, demo_stoch);
+  }
+
+private:
+  transition_matrices transitions;
+  bool demo_stoch;
+};
+
+std::unique_ptr<replicate_step> replicate_stage_projection(const landscape_state& landscape,
+                                                           const transition_matrices& transitions, bool demo_stoch){
+  return std::unique_ptr<replicate_step>(new replicate_projection(landscape, transitions, demo_stoch));
+}
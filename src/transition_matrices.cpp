@@ -0,0 +1,67 @@
+#include <Rcpp.h>
+#include <vector>
+#include "landscape_state.h"
+#include "random_streams.h"
+using namespace Rcpp;
+
+/*
+** Transition matrices for stage projections (see transition_matrices in
+** landscape_state.h), and drawing their values for environmental
+** stochasticity.
+*/
+
+transition_matrices::transition_matrices(const List& demography) : compact(false), n_stages(0) {
+  local = demography.containsElementNamed("local_transition_matrix") &&
+    !Rf_isNull(demography["local_transition_matrix"]);
+  SEXP matrices = demography[local ? "local_transition_matrix" : "global_transition_matrix"];
+
+  if (local && TYPEOF(matrices) == VECSXP){
+    List parts(matrices);
+    IntegerVector positions = parts["pattern"];
+    compact = true;
+    n_stages = as<int>(parts["stages"]);
+    values = NumericMatrix(parts["values"]);
+    pattern.resize(positions.size());
+    for (int e = 0; e < positions.size(); e++) pattern[e] = positions[e] - 1;
+  } else {
+    dense = NumericVector(matrices);
+  }
+}
+
+transition_matrices::transition_matrices(const NumericVector& matrices, bool local) :
+  local(local), compact(false), n_stages(0), dense(matrices) {}
+
+void transition_matrices::check(int stages) const {
+  if (stages < 1) stop("there must be at least one stage");
+  if (n_stages > 0 && n_stages != stages){
+    stop("the transition matrices must have one row and column per stage");
+  }
+  if (compact){
+    for (size_t e = 0; e < pattern.size(); e++){
+      if (pattern[e] < 0 || pattern[e] >= stages * stages) stop("transition matrix element out of range");
+    }
+    if (values.ncol() != (int) pattern.size()) stop("there must be a value for each non-zero transition in each cell");
+  } else if (dense.size() % (stages * stages) != 0 || dense.size() == 0){
+    stop("the transition matrices must have one row and column per stage");
+  }
+}
+
+// //' draw from truncated normal distributions into an n x k matrix, where column j is drawn with mean[j], sd[j], lower[j] and upper[j] (each of which may instead be a single value).
+// [[Rcpp::export]]
+NumericMatrix rcpp_truncated_normal(int n, NumericVector mean, NumericVector sd, NumericVector lower,
+                                    NumericVector upper){
+  int k = mean.size();
+  if (sd.size() < 1 || lower.size() < 1 || upper.size() < 1){
+    stop("sd, lower and upper must have at least one value");
+  }
+
+  NumericMatrix draws(n, k);
+  r_stream rng;
+  for (int j = 0; j < k; j++){
+    double column_sd = sd[j % sd.size()], column_lower = lower[j % lower.size()];
+    double column_upper = upper[j % upper.size()];
+    double* column = draws.begin() + (size_t) j * n;
+    for (int i = 0; i < n; i++) column[i] = rng_truncnorm(rng, mean[j], column_sd, column_lower, column_upper);
+  }
+  return draws;
+}